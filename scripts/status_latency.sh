@@ -0,0 +1,107 @@
+#!/usr/bin/env bash
+#
+# Measures GET /api/ota/status latency on a running device, idle and while
+# a firmware image is being uploaded to /api/ota/upload, over HTTP/1.1 and
+# h2c. The last case sends the upload and the polls as streams of a single
+# h2c connection, which is what the HTTP/2 server configuration is for.
+#
+# Usage: scripts/status_latency.sh <device-address> <image.bin> [polls]
+#
+# Needs curl built with HTTP/2 support; h2load (nghttp2) is used as well
+# when installed. Results are appended to $OUT (default
+# status_latency_<date>.txt) together with the device's own transfer
+# figures from /api/ota/status. Each upload leaves an image marked for
+# test in slot1 but does not reboot the device. tests/ota_h2c measures the
+# shared-connection case on native_sim, without a device.
+
+set -eu
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <device-address> <image.bin> [polls]" >&2
+    exit 1
+fi
+
+DEVICE=$1
+IMAGE=$2
+POLLS=${3:-50}
+OUT=${OUT:-status_latency_$(date +%Y%m%d_%H%M%S).txt}
+
+STATUS_URL="http://$DEVICE/api/ota/status"
+UPLOAD_URL="http://$DEVICE/api/ota/upload"
+
+# Reads latencies in seconds, one per line, prints a summary in ms
+summarise() {
+    awk '{ print $1 * 1000 }' | sort -n | awk '
+        { v[NR] = $1; sum += $1 }
+        END {
+            if (NR == 0) { print "no samples"; exit }
+            p95 = int(NR * 0.95 + 0.5); if (p95 < 1) p95 = 1
+            printf "n=%d avg=%.1f p50=%.1f p95=%.1f max=%.1f ms\n",
+                   NR, sum / NR, v[int((NR + 1) / 2)], v[p95], v[NR]
+        }'
+}
+
+# Polls the status until $POLLS samples were taken or the process given
+# as $2 has exited; $1 selects the HTTP version
+poll_status() {
+    local proto=$1 upload_pid=${2:-}
+    
+    for _ in $(seq "$POLLS"); do
+        if [ -n "$upload_pid" ] && ! kill -0 "$upload_pid" 2>/dev/null; then
+            break
+        fi
+        curl -s -o /dev/null "$proto" -w '%{time_total}\n' "$STATUS_URL"
+    done
+}
+
+start_upload() {
+    curl -s -o /dev/null "$1" -H 'Content-Type: application/octet-stream' \
+         --data-binary @"$IMAGE" "$UPLOAD_URL" &
+    UPLOAD_PID=$!
+    sleep 1  # Let the transfer reach steady state
+}
+
+record() {
+    printf '%-34s %s\n' "$1" "$2" | tee -a "$OUT"
+}
+
+{
+    echo "# $(date -u +%Y-%m-%dT%H:%M:%SZ) device=$DEVICE image=$IMAGE" \
+         "($(wc -c < "$IMAGE") bytes) polls=$POLLS"
+} | tee -a "$OUT"
+
+record "idle, HTTP/1.1" "$(poll_status --http1.1 | summarise)"
+record "idle, h2c" "$(poll_status --http2-prior-knowledge | summarise)"
+
+start_upload --http1.1
+record "upload, HTTP/1.1 connections" \
+       "$(poll_status --http1.1 "$UPLOAD_PID" | summarise)"
+wait "$UPLOAD_PID"
+
+start_upload --http2-prior-knowledge
+record "upload, h2c connections" \
+       "$(poll_status --http2-prior-knowledge "$UPLOAD_PID" | summarise)"
+wait "$UPLOAD_PID"
+
+if command -v h2load > /dev/null; then
+    start_upload --http2-prior-knowledge
+    record "upload, h2load 1 conn 1 stream" \
+           "$(h2load -n "$POLLS" -c 1 -m 1 "$STATUS_URL" |
+              awk '/time for request:/ { print "min=" $4 " max=" $5 " mean=" $6 " sd=" $7 }')"
+    wait "$UPLOAD_PID"
+fi
+
+# Upload and polls as concurrent streams of one connection. All polls are
+# issued at once next to the upload, so each one's time includes waiting
+# for its stream to be served.
+args=(-s --http2-prior-knowledge -Z --parallel-max $((POLLS + 1))
+      -H 'Content-Type: application/octet-stream' --data-binary @"$IMAGE"
+      -o /dev/null -w '%{url_effective} %{time_total}\n' "$UPLOAD_URL")
+for _ in $(seq "$POLLS"); do
+    args+=(--next -s --http2-prior-knowledge -o /dev/null
+           -w '%{url_effective} %{time_total}\n' "$STATUS_URL")
+done
+record "upload, shared h2c connection" \
+       "$(curl "${args[@]}" | awk -v url="$STATUS_URL" '$1 == url { print $2 }' | summarise)"
+
+echo "device figures: $(curl -s "$STATUS_URL")" | tee -a "$OUT"
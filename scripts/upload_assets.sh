@@ -0,0 +1,53 @@
+#!/usr/bin/env bash
+#
+# Uploads the UI asset bundle, every file in web/ by default, to a running
+# device. Each file goes to POST /api/assets/<name>, which stores it on the
+# LittleFS partition and serves it as /ui/<name>; a file that fails to
+# upload keeps its previous version on the device.
+#
+# Usage: scripts/upload_assets.sh <device-address> [asset-dir]
+#
+# index.html is sent last, so the page never refers to assets that are not
+# there yet. Stops at the first file the device rejects; a 409 means another
+# asset upload is in progress and the script can simply be run again.
+
+set -eu
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <device-address> [asset-dir]" >&2
+    exit 1
+fi
+
+DEVICE=$1
+ASSET_DIR=${2:-$(dirname "$0")/../web}
+NAME_MAX=32  # ASSET_NAME_MAX in src/web_server.c
+
+upload() {
+    local file=$1 name status
+
+    name=$(basename "$file")
+    if [ ${#name} -gt $NAME_MAX ]; then
+        echo "$name: name longer than $NAME_MAX characters" >&2
+        exit 1
+    fi
+
+    status=$(curl -s -o /dev/null -w '%{http_code}' \
+                  -H 'Content-Type: application/octet-stream' \
+                  --data-binary @"$file" "http://$DEVICE/api/assets/$name")
+    if [ "$status" != 200 ]; then
+        echo "$name: HTTP $status" >&2
+        exit 1
+    fi
+
+    echo "$name: $(wc -c < "$file") bytes"
+}
+
+for file in "$ASSET_DIR"/*; do
+    if [ -f "$file" ] && [ "$(basename "$file")" != index.html ]; then
+        upload "$file"
+    fi
+done
+
+if [ -f "$ASSET_DIR/index.html" ]; then
+    upload "$ASSET_DIR/index.html"
+fi
@@ -0,0 +1,68 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/logging/log.h>
+#include <stdio.h>
+
+#include "boot_timing.h"
+
+LOG_MODULE_REGISTER(boot_timing);
+
+static const char *const phase_names[BOOT_PHASE_COUNT] = {
+    [BOOT_PHASE_MAIN] = "main",
+    [BOOT_PHASE_SETTINGS] = "settings",
+    [BOOT_PHASE_WIFI_REQUESTED] = "wifi_requested",
+    [BOOT_PHASE_LED] = "led",
+    [BOOT_PHASE_OTA] = "ota",
+    [BOOT_PHASE_HTTP] = "http",
+    [BOOT_PHASE_WIFI_CONNECTED] = "wifi_connected",
+    [BOOT_PHASE_IP] = "ip",
+    [BOOT_PHASE_FIRST_RESPONSE] = "first_response",
+};
+
+// Milliseconds since boot at which each phase was first reached
+static uint32_t phase_ms[BOOT_PHASE_COUNT];
+static ATOMIC_DEFINE(phase_reached, BOOT_PHASE_COUNT);
+
+void boot_timing_mark(enum boot_phase phase)
+{
+    uint32_t now = k_uptime_get_32();
+    
+    // Only the first occurrence counts; reconnects do not move the mark
+    if (phase >= BOOT_PHASE_COUNT || atomic_test_bit(phase_reached, phase)) {
+        return;
+    }
+    
+    // Claim the phase first so a racing caller cannot overwrite the time
+    if (atomic_test_and_set_bit(phase_reached, phase)) {
+        return;
+    }
+    
+    phase_ms[phase] = now;
+    LOG_INF("Boot phase %s at %u ms", phase_names[phase], now);
+}
+
+int boot_timing_get_json(char *buf, size_t buf_len)
+{
+    if (!buf || buf_len == 0) {
+        return -EINVAL;
+    }
+    
+    int len = snprintf(buf, buf_len, "{");
+    bool first = true;
+    
+    for (int i = 0; i < BOOT_PHASE_COUNT && len > 0 && len < buf_len; i++) {
+        if (!atomic_test_bit(phase_reached, i)) {
+            continue;
+        }
+        
+        len += snprintf(buf + len, buf_len - len, "%s\"%s\":%u",
+                        first ? "" : ",", phase_names[i], phase_ms[i]);
+        first = false;
+    }
+    
+    if (len > 0 && len < buf_len) {
+        snprintf(buf + len, buf_len - len, "}");
+    }
+    
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef BOOT_TIMING_H
+#define BOOT_TIMING_H
+
+#include <stddef.h>
+
+// Startup milestones, in the order they normally complete
+enum boot_phase {
+    BOOT_PHASE_MAIN,
+    BOOT_PHASE_SETTINGS,
+    BOOT_PHASE_WIFI_REQUESTED,
+    BOOT_PHASE_LED,
+    BOOT_PHASE_OTA,
+    BOOT_PHASE_HTTP,
+    BOOT_PHASE_WIFI_CONNECTED,
+    BOOT_PHASE_IP,
+    BOOT_PHASE_FIRST_RESPONSE,
+    BOOT_PHASE_COUNT,
+};
+
+void boot_timing_mark(enum boot_phase phase);
+int boot_timing_get_json(char *buf, size_t buf_len);
+
+#endif
\ No newline at end of file
@@ -4,10 +4,16 @@
 #include <zephyr/net/net_if.h>
 #include <zephyr/net/net_mgmt.h>
 #include <zephyr/drivers/gpio.h>
+#if defined(CONFIG_MCUMGR_TRANSPORT_UDP)
+#include <zephyr/mgmt/mcumgr/transport/smp_udp.h>
+#endif
 
 #include "wifi_manager.h"
 #include "web_server.h"
 #include "storage.h"
+#include "ota_manager.h"
+#include "ota_multicast.h"
+#include "boot_timing.h"
 
 LOG_MODULE_REGISTER(main);
 
@@ -28,6 +34,7 @@ static void wifi_mgmt_event_handler(struct net_mgmt_event_callback *cb,
     switch (mgmt_event) {
     case NET_EVENT_WIFI_CONNECT_RESULT:
         LOG_INF("WiFi connected");
+        boot_timing_mark(BOOT_PHASE_WIFI_CONNECTED);
 #if LED_AVAILABLE
         if (device_is_ready(led.port)) {
             gpio_pin_set_dt(&led, 1);
@@ -62,8 +69,21 @@ static void ipv4_mgmt_event_handler(struct net_mgmt_event_callback *cb,
             if (net_addr_ntop(AF_INET, addr, buf, sizeof(buf))) {
                 LOG_INF("Address: %s", buf);
                 
-                // Start web server once we have IP
-                web_server_start();
+                // The web server is already listening on 0.0.0.0
+                boot_timing_mark(BOOT_PHASE_IP);
+                
+#if defined(CONFIG_APP_OTA_MULTICAST)
+                // Join the fleet update group on the new address
+                ota_multicast_start();
+#endif
+                
+#if defined(CONFIG_MCUMGR_TRANSPORT_UDP)
+                // mcumgr image uploads over SMP/UDP, port 1337
+                int ret = smp_udp_open();
+                if (ret && ret != -EALREADY) {
+                    LOG_ERR("Failed to open SMP UDP transport: %d", ret);
+                }
+#endif
             }
         }
     }
@@ -73,31 +93,21 @@ int main(void)
 {
     int ret;
     
+    boot_timing_mark(BOOT_PHASE_MAIN);
+    
     LOG_INF("ESP32 WiFi Provisioning & OTA Update Demo");
     LOG_INF("Zephyr-based WiFi OTA system initialized");
     
-    // Initialize LED if available
-#if LED_AVAILABLE
-    if (device_is_ready(led.port)) {
-        ret = gpio_pin_configure_dt(&led, GPIO_OUTPUT_INACTIVE);
-        if (ret < 0) {
-            LOG_WRN("Failed to configure LED pin");
-        }
-    } else {
-        LOG_WRN("LED device not ready");
-    }
-#else
-    LOG_INF("No LED configured");
-#endif
-    
-    // Initialize storage
+    // Stage 1: settings, needed for the saved WiFi credentials
     ret = storage_init();
     if (ret) {
         LOG_ERR("Failed to initialize storage: %d", ret);
         return ret;
     }
+    boot_timing_mark(BOOT_PHASE_SETTINGS);
     
-    // Set up network event callbacks
+    // Stage 2: start association first, it is the slowest step and
+    // completes asynchronously through the event callbacks
     net_mgmt_init_event_callback(&wifi_cb, wifi_mgmt_event_handler,
                                 NET_EVENT_WIFI_CONNECT_RESULT |
                                 NET_EVENT_WIFI_DISCONNECT_RESULT);
@@ -107,7 +117,6 @@ int main(void)
                                 NET_EVENT_IPV4_ADDR_ADD);
     net_mgmt_add_event_callback(&ipv4_cb);
     
-    // Initialize WiFi manager
     ret = wifi_manager_init();
     if (ret) {
         LOG_ERR("Failed to initialize WiFi manager: %d", ret);
@@ -116,6 +125,37 @@ int main(void)
     
     // Try to connect with saved credentials
     wifi_manager_connect_saved();
+    boot_timing_mark(BOOT_PHASE_WIFI_REQUESTED);
+    
+    // Stage 3: everything below is independent of the network and
+    // overlaps with association and DHCP
+#if LED_AVAILABLE
+    if (device_is_ready(led.port)) {
+        ret = gpio_pin_configure_dt(&led, GPIO_OUTPUT_INACTIVE);
+        if (ret < 0) {
+            LOG_WRN("Failed to configure LED pin");
+        }
+    } else {
+        LOG_WRN("LED device not ready");
+    }
+#else
+    LOG_INF("No LED configured");
+#endif
+    boot_timing_mark(BOOT_PHASE_LED);
+    
+    ret = ota_manager_init();
+    if (ret) {
+        LOG_WRN("OTA flash area unavailable: %d", ret);
+    }
+    boot_timing_mark(BOOT_PHASE_OTA);
+    
+    // Listen before the address arrives so the first request after DHCP
+    // is served immediately
+    ret = web_server_start();
+    if (ret) {
+        LOG_ERR("Failed to start web server: %d", ret);
+    }
+    boot_timing_mark(BOOT_PHASE_HTTP);
     
     LOG_INF("System initialized. Connect to AP mode or configure WiFi.");
     
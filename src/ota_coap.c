@@ -0,0 +1,399 @@
+#include <zephyr/kernel.h>
+#include <zephyr/net/coap.h>
+#include <zephyr/net/coap_service.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+
+#include "ota_manager.h"
+
+LOG_MODULE_REGISTER(ota_coap);
+
+#define OTA_COAP_BLOCK_SIZE CONFIG_APP_OTA_COAP_BLOCK_SIZE
+#define OTA_COAP_WINDOW CONFIG_APP_OTA_COAP_WINDOW
+#define OTA_COAP_REPLY_SIZE 64
+#define OTA_COAP_STATUS_SIZE 512
+#define OTA_COAP_IDLE_TIMEOUT_MS 30000
+#define OTA_COAP_NOTIFY_EVERY 16  // Blocks between status notifications
+#define OTA_COAP_WRITABLE_TIMEOUT K_SECONDS(5)
+
+struct ota_coap_slot {
+    size_t off;
+    uint16_t len;  // 0 when the slot is free
+};
+
+static struct {
+    struct sockaddr_in peer;
+    bool active;
+    uint32_t owner;     // ota_manager token of this transfer's update
+    uint16_t block_size;
+    size_t next_off;    // Offset of the next block to hand to ota_manager
+    size_t final_size;  // Image size, known once the last block arrived
+    int64_t last_activity;
+    uint32_t blocks;
+} xfer;
+
+// The transfer that completed last, so a retransmitted final block whose
+// response was lost gets the same answer again
+static struct {
+    struct sockaddr_in peer;
+    bool valid;
+    uint16_t block_size;
+    size_t final_size;
+    uint8_t code;
+} done;
+
+static struct ota_coap_slot window[OTA_COAP_WINDOW];
+static uint8_t window_buf[OTA_COAP_WINDOW][OTA_COAP_BLOCK_SIZE];
+
+static struct coap_resource *status_resource;
+
+static uint16_t coap_port = CONFIG_APP_OTA_COAP_PORT;
+COAP_SERVICE_DEFINE(ota_coap_service, NULL, &coap_port, COAP_SERVICE_AUTOSTART);
+
+static const char *const fw_path[] = { "fw", NULL };
+static const char *const fw_status_path[] = { "fw", "status", NULL };
+
+static int send_reply(struct coap_resource *resource, const struct coap_packet *request,
+                      uint8_t code, int block1, const struct sockaddr *addr,
+                      socklen_t addr_len)
+{
+    uint8_t buf[OTA_COAP_REPLY_SIZE];
+    uint8_t token[COAP_TOKEN_MAX_LEN];
+    struct coap_packet response;
+    uint8_t tkl = coap_header_get_token(request, token);
+    uint8_t type = COAP_TYPE_ACK;
+    uint16_t id = coap_header_get_id(request);
+    
+    if (coap_header_get_type(request) != COAP_TYPE_CON) {
+        type = COAP_TYPE_NON_CON;
+        id = coap_next_id();
+    }
+    
+    int ret = coap_packet_init(&response, buf, sizeof(buf), COAP_VERSION_1, type,
+                               tkl, token, code, id);
+    if (ret < 0) {
+        return ret;
+    }
+    
+    if (block1 >= 0) {
+        ret = coap_append_option_int(&response, COAP_OPTION_BLOCK1, block1);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    
+    return coap_resource_send(resource, &response, addr, addr_len, NULL);
+}
+
+static int send_status(struct coap_resource *resource, const struct sockaddr *addr,
+                       socklen_t addr_len, uint16_t age, uint16_t id,
+                       const uint8_t *token, uint8_t tkl, bool is_response)
+{
+    static uint8_t buf[OTA_COAP_STATUS_SIZE + 32];
+    static char status[OTA_COAP_STATUS_SIZE];
+    struct coap_packet response;
+    uint8_t type = is_response ? COAP_TYPE_ACK : COAP_TYPE_CON;
+    
+    if (!is_response) {
+        id = coap_next_id();
+    }
+    
+    int ret = coap_packet_init(&response, buf, sizeof(buf), COAP_VERSION_1, type,
+                               tkl, token, COAP_RESPONSE_CODE_CONTENT, id);
+    if (ret < 0) {
+        return ret;
+    }
+    
+    if (age >= 2U) {
+        coap_append_option_int(&response, COAP_OPTION_OBSERVE, age);
+    }
+    
+    coap_append_option_int(&response, COAP_OPTION_CONTENT_FORMAT,
+                           COAP_CONTENT_FORMAT_APP_JSON);
+    
+    ret = coap_packet_append_payload_marker(&response);
+    if (ret < 0) {
+        return ret;
+    }
+    
+    ota_manager_get_status(status, sizeof(status));
+    
+    ret = coap_packet_append_payload(&response, (uint8_t *)status, strlen(status));
+    if (ret < 0) {
+        return ret;
+    }
+    
+    return coap_resource_send(resource, &response, addr, addr_len, NULL);
+}
+
+static void notify_status(void)
+{
+    if (status_resource) {
+        coap_resource_notify(status_resource);
+    }
+}
+
+static bool same_peer(const struct sockaddr *addr, const struct sockaddr_in *peer)
+{
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+    
+    return sin->sin_addr.s_addr == peer->sin_addr.s_addr &&
+           sin->sin_port == peer->sin_port;
+}
+
+static bool is_peer(const struct sockaddr *addr)
+{
+    return same_peer(addr, &xfer.peer);
+}
+
+static void reset_window(void)
+{
+    for (size_t i = 0; i < OTA_COAP_WINDOW; i++) {
+        window[i].len = 0;
+    }
+}
+
+static int write_block(const uint8_t *data, size_t len)
+{
+    // Blocks are small next to the OTA buffer; waiting here delays the
+    // ACK, which is what paces the client
+    int ret = ota_manager_wait_writable(len, OTA_COAP_WRITABLE_TIMEOUT);
+    if (ret) {
+        return ret;
+    }
+    
+    return ota_manager_write_data(xfer.owner, data, len);
+}
+
+// Hands in-order data to ota_manager, then any buffered blocks that follow it
+static int write_in_order(const uint8_t *data, size_t len)
+{
+    int ret = write_block(data, len);
+    if (ret) {
+        return ret;
+    }
+    
+    xfer.next_off += len;
+    
+    for (bool progress = true; progress; ) {
+        progress = false;
+        
+        for (size_t i = 0; i < OTA_COAP_WINDOW; i++) {
+            if (window[i].len && window[i].off == xfer.next_off) {
+                ret = write_block(window_buf[i], window[i].len);
+                if (ret) {
+                    return ret;
+                }
+                
+                xfer.next_off += window[i].len;
+                window[i].len = 0;
+                progress = true;
+            }
+        }
+    }
+    
+    return 0;
+}
+
+static int fw_put(struct coap_resource *resource, struct coap_packet *request,
+                  struct sockaddr *addr, socklen_t addr_len)
+{
+    bool more = false;
+    uint32_t num = 0;
+    uint16_t payload_len = 0;
+    const uint8_t *payload = coap_packet_get_payload(request, &payload_len);
+    int size = coap_get_block1_option(request, &more, &num);
+    int64_t now = k_uptime_get();
+    
+    if (payload_len == 0) {
+        return send_reply(resource, request, COAP_RESPONSE_CODE_BAD_REQUEST,
+                          -1, addr, addr_len);
+    }
+    
+    if (size < 0) {
+        // No Block1 option: the whole image fits in one message
+        size = payload_len;
+        num = 0;
+    }
+    
+    if (size > OTA_COAP_BLOCK_SIZE || payload_len > size) {
+        // Tell the client which block size to retry with
+        return send_reply(resource, request, COAP_RESPONSE_CODE_REQUEST_TOO_LARGE,
+                          coap_bytes_to_block_size(OTA_COAP_BLOCK_SIZE), addr, addr_len);
+    }
+    
+    int block1 = (num << 4) | (more ? BIT(3) : 0) | coap_bytes_to_block_size(size);
+    size_t off = (size_t)num * size;
+    
+    if (xfer.active && !is_peer(addr)) {
+        if (num != 0 || now - xfer.last_activity < OTA_COAP_IDLE_TIMEOUT_MS) {
+            return send_reply(resource, request, COAP_RESPONSE_CODE_SERVICE_UNAVAILABLE,
+                              -1, addr, addr_len);
+        }
+        
+        LOG_WRN("Abandoning idle CoAP transfer");
+        ota_manager_abort_update(xfer.owner);
+        xfer.active = false;
+    }
+    
+    if (!xfer.active && num != 0 && done.valid && same_peer(addr, &done.peer) &&
+        size == done.block_size && off < done.final_size) {
+        // Retransmission into the transfer that already completed
+        return send_reply(resource, request, more ? COAP_RESPONSE_CODE_CONTINUE : done.code,
+                          block1, addr, addr_len);
+    }
+    
+    if (!xfer.active) {
+        if (num != 0) {
+            return send_reply(resource, request, COAP_RESPONSE_CODE_INCOMPLETE,
+                              -1, addr, addr_len);
+        }
+        
+        int ret = ota_manager_start_update(&xfer.owner);
+        if (ret) {
+            return send_reply(resource, request, COAP_RESPONSE_CODE_SERVICE_UNAVAILABLE,
+                              -1, addr, addr_len);
+        }
+        
+        memcpy(&xfer.peer, addr, sizeof(xfer.peer));
+        done.valid = false;
+        xfer.active = true;
+        xfer.block_size = size;
+        xfer.next_off = 0;
+        xfer.final_size = 0;
+        xfer.blocks = 0;
+        reset_window();
+        
+        LOG_INF("CoAP OTA transfer started, block size %d", size);
+        notify_status();
+    }
+    
+    xfer.last_activity = now;
+    
+    if (size != xfer.block_size) {
+        return send_reply(resource, request, COAP_RESPONSE_CODE_BAD_REQUEST,
+                          -1, addr, addr_len);
+    }
+    
+    if (!more) {
+        xfer.final_size = off + payload_len;
+    }
+    
+    int ret = 0;
+    size_t prev_off = xfer.next_off;
+    
+    if (off == xfer.next_off) {
+        ret = write_in_order(payload, payload_len);
+    } else if (off < xfer.next_off) {
+        // Blocks of a sector that failed readback are its replacement and
+        // must come in order; anything else behind next_off is a
+        // retransmission whose ACK was lost
+        if (ota_manager_sector_is_bad(off / OTA_MANAGER_SECTOR_SIZE)) {
+            ret = ota_manager_repair_data(xfer.owner, off, payload, payload_len);
+            if (ret == -EPERM) {
+                // The update was aborted or taken over under this transfer
+                xfer.active = false;
+            }
+            if (ret) {
+                return send_reply(resource, request, COAP_RESPONSE_CODE_INCOMPLETE,
+                                  -1, addr, addr_len);
+            }
+        }
+    } else {
+        size_t slot = num % OTA_COAP_WINDOW;
+        
+        if (off >= xfer.next_off + OTA_COAP_WINDOW * xfer.block_size) {
+            return send_reply(resource, request, COAP_RESPONSE_CODE_INCOMPLETE,
+                              -1, addr, addr_len);
+        }
+        
+        memcpy(window_buf[slot], payload, payload_len);
+        window[slot].off = off;
+        window[slot].len = payload_len;
+    }
+    
+    if (ret) {
+        LOG_ERR("CoAP OTA write failed: %d", ret);
+        ota_manager_abort_update(xfer.owner);
+        xfer.active = false;
+        notify_status();
+        return send_reply(resource, request, COAP_RESPONSE_CODE_INTERNAL_ERROR,
+                          -1, addr, addr_len);
+    }
+    
+    if (++xfer.blocks % OTA_COAP_NOTIFY_EVERY == 0) {
+        notify_status();
+    }
+    
+    // Finish when this block closed the last gap, and again whenever the
+    // final block is re-sent after rejected sectors were repaired
+    bool complete = xfer.final_size && xfer.next_off == xfer.final_size;
+    
+    if (!complete || (more && prev_off == xfer.next_off)) {
+        return send_reply(resource, request, COAP_RESPONSE_CODE_CONTINUE,
+                          block1, addr, addr_len);
+    }
+    
+    ret = ota_manager_finish_update(xfer.owner);
+    
+    uint8_t code = COAP_RESPONSE_CODE_CHANGED;
+    
+    if (ret == -EAGAIN) {
+        // Still open; the status lists the sectors to re-send, after which
+        // the final block is sent again
+        code = COAP_RESPONSE_CODE_INCOMPLETE;
+    } else if (ret == -ETIMEDOUT) {
+        // Still open; the client retries the final block later
+        code = COAP_RESPONSE_CODE_SERVICE_UNAVAILABLE;
+    } else {
+        if (ret) {
+            ota_manager_abort_update(xfer.owner);
+            code = COAP_RESPONSE_CODE_INTERNAL_ERROR;
+        }
+        
+        xfer.active = false;
+        memcpy(&done.peer, &xfer.peer, sizeof(done.peer));
+        done.block_size = xfer.block_size;
+        done.final_size = xfer.final_size;
+        done.code = code;
+        done.valid = true;
+    }
+    notify_status();
+    
+    LOG_INF("CoAP OTA transfer complete, %zu bytes: %d", xfer.final_size, ret);
+    return send_reply(resource, request, code, block1, addr, addr_len);
+}
+
+static int fw_status_get(struct coap_resource *resource, struct coap_packet *request,
+                         struct sockaddr *addr, socklen_t addr_len)
+{
+    uint8_t token[COAP_TOKEN_MAX_LEN];
+    uint16_t id = coap_header_get_id(request);
+    uint8_t tkl = coap_header_get_token(request, token);
+    
+    int ret = coap_resource_parse_observe(resource, request, addr);
+    
+    status_resource = resource;
+    
+    return send_status(resource, addr, addr_len, ret == 0 ? resource->age : 0,
+                       id, token, tkl, true);
+}
+
+static void fw_status_notify(struct coap_resource *resource, struct coap_observer *observer)
+{
+    send_status(resource, &observer->addr, sizeof(observer->addr), resource->age, 0,
+                observer->token, observer->tkl, false);
+}
+
+COAP_RESOURCE_DEFINE(ota_coap_fw, ota_coap_service, {
+    .path = fw_path,
+    .put = fw_put,
+    .post = fw_put,
+});
+
+COAP_RESOURCE_DEFINE(ota_coap_fw_status, ota_coap_service, {
+    .path = fw_status_path,
+    .get = fw_status_get,
+    .notify = fw_status_notify,
+});
\ No newline at end of file
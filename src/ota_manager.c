@@ -4,17 +4,677 @@
 #include <zephyr/logging/log.h>
 #include <zephyr/net/socket.h>
 #include <zephyr/net/http/client.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/ring_buffer.h>
+#if defined(CONFIG_MCUMGR_GRP_IMG_UPLOAD_CHECK_HOOK)
+#include <zephyr/mgmt/mcumgr/mgmt/mgmt_defines.h>
+#include <zephyr/mgmt/mcumgr/mgmt/callbacks.h>
+#include <zephyr/mgmt/mcumgr/grp/img_mgmt/img_mgmt.h>
+#include <zephyr/mgmt/mcumgr/grp/img_mgmt/img_mgmt_callbacks.h>
+#endif
 #include <string.h>
+#include <stdlib.h>
 
 #include "ota_manager.h"
+#include "wifi_manager.h"
+#if defined(CONFIG_SETTINGS)
+#include "storage.h"
+#endif
 
 LOG_MODULE_REGISTER(ota_manager);
 
+#define FLASH_AREA_IMAGE_PRIMARY FIXED_PARTITION_ID(slot0_partition)
 #define FLASH_AREA_IMAGE_SECONDARY FIXED_PARTITION_ID(slot1_partition)
+#define OTA_MAX_SECTORS (FIXED_PARTITION_SIZE(slot1_partition) / OTA_MANAGER_SECTOR_SIZE)
+
+// Sector CRCs are built from fixed-size granules so that the verifier can
+// recompute them from readback without knowing how the data was chunked
+#define OTA_CRC_GRANULE 256
+
+#define OTA_VERIFY_STACK_SIZE 1024
+#define OTA_VERIFY_PRIORITY K_LOWEST_APPLICATION_THREAD_PRIO
+#define OTA_VERIFY_TIMEOUT K_SECONDS(30)
+
+// Incoming data is staged here and programmed a whole sector at a time by
+// the writer thread; producers that find it full wait for it to drain to
+// the resume level instead of blocking in flash writes
+#define OTA_WRITE_BUF_SIZE (4 * OTA_MANAGER_SECTOR_SIZE)
+#define OTA_WRITE_RESUME_LEVEL (OTA_WRITE_BUF_SIZE / 2)
+#define OTA_WRITER_STACK_SIZE 2048
+#define OTA_WRITER_PRIORITY 6
+#define OTA_FLUSH_TIMEOUT K_SECONDS(10)
+
+#define OTA_URL_MAX_LEN 128
+#define OTA_HOST_MAX_LEN 64
+#define OTA_HTTP_RECV_BUF_SIZE 1024
+#define OTA_HTTP_TIMEOUT_MS 10000
+#define OTA_HTTP_RETRIES 3
+#define OTA_DOWNLOAD_STACK_SIZE 4096
+#define OTA_DOWNLOAD_PRIORITY 7
+
+#define OTA_SMP_IDLE_TIMEOUT_MS 30000
+
+#define MCUBOOT_IMAGE_MAGIC 0x96f3b83d
+#define MCUBOOT_TLV_INFO_MAGIC 0x6907
+#define MCUBOOT_TLV_PROT_INFO_MAGIC 0x6908
+
+struct ota_sector {
+    uint32_t crc;          // XOR of the CRC32 of every granule folded so far
+    uint32_t granule_crc;  // CRC32 of the granule still being written
+    uint16_t fill;         // Bytes programmed into the sector so far
+    uint16_t generation;   // Bumped whenever the sector is erased for refill
+};
 
 static const struct flash_area *flash_area;
-static size_t bytes_written = 0;
+static size_t bytes_written = 0;  // Accepted, possibly still buffered
+static size_t bytes_flushed = 0;  // Programmed into flash
+static int write_error;
+static size_t image_size = 0;
 static bool update_in_progress = false;
+// Token of the transport that owns the slot, 0 when free. Taken before
+// the slot is erased and released last when the update ends, so transports
+// on different threads cannot start updates concurrently, and one whose
+// update was aborted or taken over cannot write into the next
+static atomic_t slot_owner;
+static atomic_t owner_seq;
+
+// Receive-side figures for one transfer, kept for the last two so the
+// effect of the WiFi OTA profile can be compared on the same device
+struct ota_transfer_stats {
+    size_t bytes;
+    uint32_t duration_ms;
+    uint32_t chunks;
+    uint64_t gap_sum_us;  // Time between consecutive chunks
+    uint32_t gap_max_us;
+    bool wifi_profile;    // Power save was off for the transfer
+    bool completed;
+};
+
+static struct ota_transfer_stats transfer;
+static struct ota_transfer_stats transfer_history[2];  // Last, previous; persisted
+static bool wifi_profile_enabled = IS_ENABLED(CONFIG_APP_OTA_WIFI_PROFILE);
+static int64_t transfer_start;
+static int64_t transfer_last_chunk;  // In ticks, 0 before the first chunk
+
+// Each sector keeps its own open granule, so a repair landing in one
+// sector never disturbs the stream that is still filling another
+static struct ota_sector sectors[OTA_MAX_SECTORS];
+// Sectors the verifier rejected; a bit stays set until the replacement
+// data has filled the sector and read back correctly
+static ATOMIC_DEFINE(refill_sectors, OTA_MAX_SECTORS);
+static atomic_t verify_pending;
+
+// Set while img_mgmt owns the slot: it programs the data itself, buffered,
+// so sectors are only queued for readback once it has moved past them
+static bool verify_deferred;
+
+// Running image, served to peers
+static const struct flash_area *primary_area;
+static size_t primary_image_size;
+
+static char pull_url[OTA_URL_MAX_LEN];
+static atomic_t pull_pending;
+static K_SEM_DEFINE(pull_sem, 0, 1);
+
+RING_BUF_DECLARE(write_ring, OTA_WRITE_BUF_SIZE);
+static struct k_spinlock ring_lock;
+static K_MUTEX_DEFINE(write_lock);  // Serialises flash programming and CRC tracking
+static K_SEM_DEFINE(write_sem, 0, 1);
+static K_SEM_DEFINE(writable_sem, 0, 1);
+static K_SEM_DEFINE(drained_sem, 0, 1);
+static atomic_t flush_requested;
+
+// Sectors waiting for readback. A bitmap rather than a queue, so queueing
+// never blocks the writer while it holds write_lock, which the verifier
+// needs to erase a rejected sector
+static ATOMIC_DEFINE(verify_sectors, OTA_MAX_SECTORS);
+static K_SEM_DEFINE(verify_sem, 0, 1);
+static K_SEM_DEFINE(verify_done, 0, 1);
+
+static size_t ota_sector_expected_len(size_t idx)
+{
+    size_t start = idx * OTA_MANAGER_SECTOR_SIZE;
+    
+    // Only the last sector can be short, and only once the image size is known
+    if (image_size && start + OTA_MANAGER_SECTOR_SIZE > image_size) {
+        return image_size - start;
+    }
+    
+    return OTA_MANAGER_SECTOR_SIZE;
+}
+
+static void ota_queue_verify(uint16_t idx)
+{
+    if (!atomic_test_and_set_bit(verify_sectors, idx)) {
+        atomic_inc(&verify_pending);
+    }
+    k_sem_give(&verify_sem);
+}
+
+static void ota_fold_granule(size_t idx)
+{
+    struct ota_sector *sector = &sectors[idx];
+    
+    sector->crc ^= sector->granule_crc;
+    sector->granule_crc = 0;
+    
+    if (!verify_deferred && sector->fill == ota_sector_expected_len(idx)) {
+        ota_queue_verify(idx);
+    }
+}
+
+static void ota_track_crc(size_t off, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        size_t idx = off / OTA_MANAGER_SECTOR_SIZE;
+        size_t n = MIN(len, OTA_CRC_GRANULE - off % OTA_CRC_GRANULE);
+        
+        sectors[idx].granule_crc = crc32_ieee_update(sectors[idx].granule_crc, data, n);
+        sectors[idx].fill += n;
+        
+        off += n;
+        data += n;
+        len -= n;
+        
+        if (off % OTA_CRC_GRANULE == 0 || (image_size && off == image_size)) {
+            ota_fold_granule(idx);
+        }
+    }
+}
+
+static int ota_write_at(size_t off, const uint8_t *data, size_t len)
+{
+    if (off + len > flash_area->fa_size) {
+        LOG_ERR("Data too large for flash area");
+        return -ENOSPC;
+    }
+    
+    // Writes may start mid-granule only to continue the sector's open one
+    if ((off % OTA_CRC_GRANULE) != 0 &&
+        off % OTA_MANAGER_SECTOR_SIZE != sectors[off / OTA_MANAGER_SECTOR_SIZE].fill) {
+        LOG_ERR("Non-sequential write at offset %zu", off);
+        return -EINVAL;
+    }
+    
+    // Programming a sector past its length would corrupt data already there
+    for (size_t pos = off; pos < off + len; ) {
+        size_t idx = pos / OTA_MANAGER_SECTOR_SIZE;
+        size_t end = MIN(off + len, (idx + 1) * OTA_MANAGER_SECTOR_SIZE);
+        
+        if (sectors[idx].fill + (end - pos) > ota_sector_expected_len(idx)) {
+            LOG_ERR("Sector %zu is already complete", idx);
+            return -EINVAL;
+        }
+        pos = end;
+    }
+    
+    int ret = flash_area_write(flash_area, off, data, len);
+    if (ret) {
+        LOG_ERR("Failed to write to flash: %d", ret);
+        return ret;
+    }
+    
+    ota_track_crc(off, data, len);
+    return 0;
+}
+
+// Leaves the sector erased and flagged so re-sent data can be programmed
+static void ota_reset_sector(size_t idx)
+{
+    // Bumped before the erase, so a reader that saw the old generation
+    // after reading the sector knows its data may already be gone
+    sectors[idx].generation++;
+    
+    if (flash_area_erase(flash_area, idx * OTA_MANAGER_SECTOR_SIZE,
+                         OTA_MANAGER_SECTOR_SIZE)) {
+        LOG_ERR("Failed to erase sector %zu", idx);
+    }
+    
+    sectors[idx].crc = 0;
+    sectors[idx].granule_crc = 0;
+    sectors[idx].fill = 0;
+    atomic_set_bit(refill_sectors, idx);
+}
+
+static void ota_verify_sector(uint16_t idx)
+{
+    static uint8_t buf[OTA_CRC_GRANULE];
+    size_t start = idx * OTA_MANAGER_SECTOR_SIZE;
+    size_t len = sectors[idx].fill;
+    uint32_t crc = 0;
+    bool ok = true;
+    
+    for (size_t off = 0; off < len; off += OTA_CRC_GRANULE) {
+        size_t n = MIN(len - off, OTA_CRC_GRANULE);
+        
+        if (flash_area_read(flash_area, start + off, buf, n)) {
+            ok = false;
+            break;
+        }
+        
+        crc ^= crc32_ieee(buf, n);
+    }
+    
+    if (ok && crc == sectors[idx].crc) {
+        LOG_DBG("Sector %u verified", idx);
+        atomic_clear_bit(refill_sectors, idx);
+        return;
+    }
+    
+    LOG_WRN("Sector %u readback mismatch, requesting it again", idx);
+    
+    k_mutex_lock(&write_lock, K_FOREVER);
+    ota_reset_sector(idx);
+    k_mutex_unlock(&write_lock);
+}
+
+static void ota_verify_thread(void *p1, void *p2, void *p3)
+{
+    while (1) {
+        k_sem_take(&verify_sem, K_FOREVER);
+        
+        for (uint16_t idx = 0; idx < OTA_MAX_SECTORS; idx++) {
+            if (!atomic_test_and_clear_bit(verify_sectors, idx)) {
+                continue;
+            }
+            
+            ota_verify_sector(idx);
+            
+            if (atomic_dec(&verify_pending) == 1) {
+                k_sem_give(&verify_done);
+            }
+        }
+    }
+}
+
+K_THREAD_DEFINE(ota_verify_tid, OTA_VERIFY_STACK_SIZE, ota_verify_thread,
+                NULL, NULL, NULL, OTA_VERIFY_PRIORITY, 0, 0);
+
+static int ota_wait_verified(k_timeout_t timeout)
+{
+    while (atomic_get(&verify_pending) > 0) {
+        if (k_sem_take(&verify_done, timeout)) {
+            return -ETIMEDOUT;
+        }
+    }
+    
+    return 0;
+}
+
+static size_t ota_ring_space(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&ring_lock);
+    size_t space = ring_buf_space_get(&write_ring);
+    
+    k_spin_unlock(&ring_lock, key);
+    return space;
+}
+
+static size_t ota_ring_used(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&ring_lock);
+    size_t used = ring_buf_size_get(&write_ring);
+    
+    k_spin_unlock(&ring_lock, key);
+    return used;
+}
+
+static void ota_writer_thread(void *p1, void *p2, void *p3)
+{
+    while (1) {
+        k_sem_take(&write_sem, K_FOREVER);
+        
+        while (1) {
+            size_t want = OTA_MANAGER_SECTOR_SIZE - bytes_flushed % OTA_MANAGER_SECTOR_SIZE;
+            size_t used = ota_ring_used();
+            
+            // Hold back partial sectors until the producer is done
+            if (used == 0 || (used < want && !atomic_get(&flush_requested))) {
+                break;
+            }
+            
+            k_mutex_lock(&write_lock, K_FOREVER);
+            
+            uint8_t *data;
+            k_spinlock_key_t key = k_spin_lock(&ring_lock);
+            size_t n = ring_buf_get_claim(&write_ring, &data, want);
+            k_spin_unlock(&ring_lock, key);
+            
+            // After a failure the rest is discarded; write_data reports it
+            if (write_error == 0) {
+                write_error = ota_write_at(bytes_flushed, data, n);
+            }
+            
+            key = k_spin_lock(&ring_lock);
+            ring_buf_get_finish(&write_ring, n);
+            k_spin_unlock(&ring_lock, key);
+            
+            bytes_flushed += n;
+            k_mutex_unlock(&write_lock);
+            
+            if (bytes_flushed % OTA_MANAGER_SECTOR_SIZE == 0) {
+                LOG_DBG("Programmed %zu bytes", bytes_flushed);
+            }
+            
+            if (ota_ring_space() >= OTA_WRITE_RESUME_LEVEL) {
+                k_sem_give(&writable_sem);
+            }
+        }
+        
+        k_sem_give(&writable_sem);
+        k_sem_give(&drained_sem);
+    }
+}
+
+K_THREAD_DEFINE(ota_writer_tid, OTA_WRITER_STACK_SIZE, ota_writer_thread,
+                NULL, NULL, NULL, OTA_WRITER_PRIORITY, 0, 0);
+
+// Programs everything still buffered, including a trailing partial sector
+static int ota_flush(k_timeout_t timeout)
+{
+    int ret = 0;
+    
+    atomic_set(&flush_requested, 1);
+    
+    while (ota_ring_used() > 0) {
+        k_sem_give(&write_sem);
+        if (k_sem_take(&drained_sem, timeout)) {
+            ret = -ETIMEDOUT;
+            break;
+        }
+    }
+    
+    atomic_set(&flush_requested, 0);
+    
+    // Wait out the writer's last sector
+    k_mutex_lock(&write_lock, K_FOREVER);
+    k_mutex_unlock(&write_lock);
+    
+    return ret ? ret : write_error;
+}
+
+static size_t ota_bad_sector_count(void)
+{
+    size_t count = 0;
+    
+    for (size_t i = 0; i < OTA_MAX_SECTORS; i++) {
+        if (atomic_test_bit(refill_sectors, i)) {
+            count++;
+        }
+    }
+    
+    return count;
+}
+
+// Flags every sector of the image that is not completely programmed; ones
+// holding partial data are erased so they can be sent again from the start
+static size_t ota_flag_incomplete_sectors(void)
+{
+    k_mutex_lock(&write_lock, K_FOREVER);
+    
+    for (size_t i = 0; i * OTA_MANAGER_SECTOR_SIZE < image_size; i++) {
+        if (sectors[i].fill == ota_sector_expected_len(i)) {
+            continue;
+        }
+        
+        if (sectors[i].fill) {
+            LOG_WRN("Sector %zu incomplete (%u bytes)", i, sectors[i].fill);
+            ota_reset_sector(i);
+        } else {
+            atomic_set_bit(refill_sectors, i);
+        }
+    }
+    
+    k_mutex_unlock(&write_lock);
+    
+    return ota_bad_sector_count();
+}
+
+static void ota_reset_tracking(void)
+{
+    memset(sectors, 0, sizeof(sectors));
+    for (size_t i = 0; i < ATOMIC_BITMAP_SIZE(OTA_MAX_SECTORS); i++) {
+        atomic_clear(&refill_sectors[i]);
+    }
+    image_size = 0;
+    bytes_written = 0;
+    bytes_flushed = 0;
+    write_error = 0;
+}
+
+static void ota_session_begin(void)
+{
+    memset(&transfer, 0, sizeof(transfer));
+    transfer_start = k_uptime_get();
+    transfer_last_chunk = 0;
+    
+#if defined(CONFIG_APP_OTA_WIFI_PROFILE)
+    if (wifi_profile_enabled) {
+        transfer.wifi_profile = wifi_manager_ota_profile_enter() == 0;
+    }
+#endif
+    
+    update_in_progress = true;
+}
+
+static void ota_session_chunk(size_t len)
+{
+    int64_t now = k_uptime_ticks();
+    
+    if (transfer_last_chunk) {
+        uint32_t gap = (uint32_t)k_ticks_to_us_floor64(now - transfer_last_chunk);
+        
+        transfer.gap_sum_us += gap;
+        transfer.gap_max_us = MAX(transfer.gap_max_us, gap);
+    }
+    
+    transfer_last_chunk = now;
+    transfer.chunks++;
+    transfer.bytes += len;
+}
+
+static void ota_session_end(bool completed)
+{
+    update_in_progress = false;
+    
+#if defined(CONFIG_APP_OTA_WIFI_PROFILE)
+    if (transfer.wifi_profile) {
+        wifi_manager_ota_profile_leave();
+    }
+#endif
+    
+    if (transfer.chunks > 0) {
+        transfer.duration_ms = (uint32_t)(k_uptime_get() - transfer_start);
+        transfer.completed = completed;
+        transfer_history[1] = transfer_history[0];
+        transfer_history[0] = transfer;
+#if defined(CONFIG_SETTINGS)
+        storage_save_ota_history(transfer_history, sizeof(transfer_history));
+#endif
+        
+        LOG_INF("Transfer of %zu bytes took %u ms", transfer.bytes, transfer.duration_ms);
+    }
+    
+    atomic_clear(&slot_owner);
+}
+
+// Returns the new owner token, or 0 if the slot is taken
+static uint32_t ota_claim_slot(void)
+{
+    uint32_t owner;
+    
+    do {
+        owner = (uint32_t)atomic_inc(&owner_seq) + 1;
+    } while (owner == OTA_MANAGER_OWNER_ANY);
+    
+    return atomic_cas(&slot_owner, 0, owner) ? owner : 0;
+}
+
+static int ota_check_owner(uint32_t owner)
+{
+    if (!update_in_progress) {
+        LOG_ERR("No update in progress");
+        return -EINVAL;
+    }
+    
+    if (owner != (uint32_t)atomic_get(&slot_owner)) {
+        LOG_ERR("Update belongs to another transfer");
+        return -EPERM;
+    }
+    
+    return 0;
+}
+
+static int ota_transfer_json(char *buf, size_t buf_len, const struct ota_transfer_stats *t)
+{
+    if (t->chunks == 0) {
+        return snprintf(buf, buf_len, "null");
+    }
+    
+    return snprintf(buf, buf_len,
+                    "{\"bytes\":%zu,\"ms\":%u,\"kbps\":%u,\"gap_avg_us\":%u,"
+                    "\"gap_max_us\":%u,\"wifi_profile\":%s,\"completed\":%s}",
+                    t->bytes, t->duration_ms,
+                    (uint32_t)((uint64_t)t->bytes * 8 / MAX(t->duration_ms, 1U)),
+                    t->chunks > 1 ? (uint32_t)(t->gap_sum_us / (t->chunks - 1)) : 0,
+                    t->gap_max_us, t->wifi_profile ? "true" : "false",
+                    t->completed ? "true" : "false");
+}
+
+#if defined(CONFIG_MCUMGR_GRP_IMG_UPLOAD_CHECK_HOOK)
+// img_mgmt writes SMP uploads through its own stream_flash; these hooks
+// only see each chunk before it is written, for exclusion, CRC tracking
+// and the readback check once img_mgmt has programmed a sector
+static bool smp_upload;
+static uint32_t smp_owner;
+static size_t smp_flushed;  // Sectors img_mgmt has already programmed
+static int64_t smp_last_chunk;
+
+static void ota_smp_queue_flushed(size_t upto)
+{
+    for (; smp_flushed < upto; smp_flushed++) {
+        if (sectors[smp_flushed].fill == ota_sector_expected_len(smp_flushed)) {
+            ota_queue_verify(smp_flushed);
+        }
+    }
+}
+
+static int ota_smp_upload_check(const struct img_mgmt_upload_check *check)
+{
+    const struct img_mgmt_upload_req *req = check->req;
+    
+    if (req->image != 0) {
+        return 0;
+    }
+    
+    if (req->off == 0) {
+        // A new SMP upload may replace a stale one, never another transport
+        if (!smp_upload) {
+            smp_owner = ota_claim_slot();
+            if (!smp_owner) {
+                LOG_WRN("Rejecting SMP upload, update already in progress");
+                return MGMT_ERR_EBUSY;
+            }
+        }
+        
+        if (ota_wait_verified(OTA_VERIFY_TIMEOUT)) {
+            if (!smp_upload) {
+                atomic_clear(&slot_owner);
+            }
+            return MGMT_ERR_EBUSY;
+        }
+        
+        ota_reset_tracking();
+        image_size = check->action->size;
+        ota_session_begin();
+        verify_deferred = true;
+        smp_upload = true;
+        smp_flushed = 0;
+        
+        LOG_INF("SMP upload started, %zu bytes", image_size);
+    } else if (!smp_upload) {
+        // Resumed after a reboot: no CRCs for the data already in the slot
+        return atomic_get(&slot_owner) ? MGMT_ERR_EBUSY : 0;
+    }
+    
+    smp_last_chunk = k_uptime_get();
+    
+    if (req->off != bytes_written) {
+        return 0;
+    }
+    
+    // Everything before this chunk has left img_mgmt's sector-sized buffer
+    ota_smp_queue_flushed(req->off / OTA_MANAGER_SECTOR_SIZE);
+    ota_track_crc(req->off, req->img_data.value, req->img_data.len);
+    bytes_written += req->img_data.len;
+    ota_session_chunk(req->img_data.len);
+    
+    return 0;
+}
+
+static void ota_smp_finish(void)
+{
+    bool verified = false;
+    
+    ota_smp_queue_flushed(DIV_ROUND_UP(image_size, OTA_MANAGER_SECTOR_SIZE));
+    
+    if (ota_wait_verified(OTA_VERIFY_TIMEOUT)) {
+        LOG_ERR("Timed out waiting for readback verification");
+    } else if (ota_flag_incomplete_sectors()) {
+        // img_mgmt cannot rewrite single sectors; drop the header so the
+        // slot reads as empty and the image is uploaded again
+        LOG_ERR("%zu sector(s) failed readback, discarding SMP image",
+                ota_bad_sector_count());
+        flash_area_erase(flash_area, 0, OTA_MANAGER_SECTOR_SIZE);
+    } else {
+        LOG_INF("SMP upload verified, %zu bytes", bytes_written);
+        verified = true;
+    }
+    
+    smp_upload = false;
+    verify_deferred = false;
+    ota_session_end(verified);
+}
+
+static enum mgmt_cb_return ota_smp_callback(uint32_t event, enum mgmt_cb_return prev_status,
+                                            int32_t *rc, uint16_t *group, bool *abort_more,
+                                            void *data, size_t data_size)
+{
+    switch (event) {
+    case MGMT_EVT_OP_IMG_MGMT_DFU_CHUNK:
+        *rc = ota_smp_upload_check(data);
+        if (*rc) {
+            return MGMT_CB_ERROR_RC;
+        }
+        break;
+    case MGMT_EVT_OP_IMG_MGMT_DFU_PENDING:
+        if (smp_upload && ota_check_owner(smp_owner) == 0) {
+            ota_smp_finish();
+        }
+        break;
+    case MGMT_EVT_OP_IMG_MGMT_DFU_STOPPED:
+        if (smp_upload && ota_check_owner(smp_owner) == 0) {
+            LOG_WRN("SMP upload stopped after %zu bytes", bytes_written);
+            smp_upload = false;
+            verify_deferred = false;
+            ota_session_end(false);
+        }
+        break;
+    default:
+        break;
+    }
+    
+    return MGMT_CB_OK;
+}
+
+static struct mgmt_callback ota_smp_cb = {
+    .callback = ota_smp_callback,
+    .event_id = MGMT_EVT_OP_IMG_MGMT_DFU_CHUNK | MGMT_EVT_OP_IMG_MGMT_DFU_PENDING |
+                MGMT_EVT_OP_IMG_MGMT_DFU_STOPPED,
+};
+#endif
 
 int ota_manager_init(void)
 {
@@ -24,43 +684,88 @@ int ota_manager_init(void)
         return ret;
     }
     
+#if defined(CONFIG_MCUMGR_GRP_IMG_UPLOAD_CHECK_HOOK)
+    // mcumgr uploads share the slot, the exclusion and the readback check
+    mgmt_callback_register(&ota_smp_cb);
+#endif
+    
+#if defined(CONFIG_SETTINGS)
+    // Kept across the reboot into a new image, so a transfer with the WiFi
+    // profile and one without can be compared on the same device
+    storage_load_ota_history(transfer_history, sizeof(transfer_history));
+#if defined(CONFIG_APP_OTA_WIFI_PROFILE)
+    storage_load_ota_wifi_profile(&wifi_profile_enabled);
+#endif
+#endif
+    
     LOG_INF("OTA manager initialized");
     return 0;
 }
 
-int ota_manager_start_update(void)
+int ota_manager_start_update(uint32_t *owner)
 {
-    if (update_in_progress) {
+#if defined(CONFIG_MCUMGR_GRP_IMG_UPLOAD_CHECK_HOOK)
+    // An SMP client that went away without stopping gives the slot back
+    if (update_in_progress && smp_upload &&
+        k_uptime_get() - smp_last_chunk > OTA_SMP_IDLE_TIMEOUT_MS) {
+        LOG_WRN("Abandoning idle SMP upload");
+        smp_upload = false;
+        verify_deferred = false;
+        ota_session_end(false);
+    }
+#endif
+    
+    // Claimed before the slow wait and erase below, which another
+    // transport's thread could otherwise interleave with
+    uint32_t claimed = ota_claim_slot();
+    
+    if (!claimed) {
         LOG_WRN("Update already in progress");
         return -EBUSY;
     }
     
+    int ret = 0;
+    
     if (!flash_area) {
-        int ret = ota_manager_init();
+        ret = ota_manager_init();
+    }
+    
+    // Let the verifier finish with any aborted update before erasing
+    if (ret == 0 && ota_wait_verified(OTA_VERIFY_TIMEOUT)) {
+        LOG_ERR("Verifier still busy");
+        ret = -EBUSY;
+    }
+    
+    // Erase the secondary slot, with the writer and verifier kept out of
+    // the slot and the tracking state until both are fresh
+    if (ret == 0) {
+        k_mutex_lock(&write_lock, K_FOREVER);
+        ret = flash_area_erase(flash_area, 0, flash_area->fa_size);
         if (ret) {
-            return ret;
+            LOG_ERR("Failed to erase flash area: %d", ret);
+        } else {
+            ota_reset_tracking();
         }
+        k_mutex_unlock(&write_lock);
     }
     
-    // Erase the secondary slot
-    int ret = flash_area_erase(flash_area, 0, flash_area->fa_size);
     if (ret) {
-        LOG_ERR("Failed to erase flash area: %d", ret);
+        atomic_clear(&slot_owner);
         return ret;
     }
     
-    bytes_written = 0;
-    update_in_progress = true;
+    ota_session_begin();
+    *owner = claimed;
     
     LOG_INF("OTA update started");
     return 0;
 }
 
-int ota_manager_write_data(const uint8_t *data, size_t len)
+int ota_manager_write_data(uint32_t owner, const uint8_t *data, size_t len)
 {
-    if (!update_in_progress) {
-        LOG_ERR("No update in progress");
-        return -EINVAL;
+    int ret = ota_check_owner(owner);
+    if (ret) {
+        return ret;
     }
     
     if (!flash_area) {
@@ -68,18 +773,26 @@ int ota_manager_write_data(const uint8_t *data, size_t len)
         return -EINVAL;
     }
     
-    if (bytes_written + len > flash_area->fa_size) {
-        LOG_ERR("Data too large for flash area");
-        return -ENOSPC;
+    if (write_error) {
+        return write_error;
     }
     
-    int ret = flash_area_write(flash_area, bytes_written, data, len);
-    if (ret) {
-        LOG_ERR("Failed to write to flash: %d", ret);
-        return ret;
+    // All or nothing, so callers can simply retry the same chunk
+    k_spinlock_key_t key = k_spin_lock(&ring_lock);
+    bool fits = ring_buf_space_get(&write_ring) >= len;
+    
+    if (fits) {
+        ring_buf_put(&write_ring, data, len);
+    }
+    k_spin_unlock(&ring_lock, key);
+    
+    if (!fits) {
+        return -EAGAIN;
     }
     
     bytes_written += len;
+    ota_session_chunk(len);
+    k_sem_give(&write_sem);
     
     if (bytes_written % 4096 == 0) {  // Log every 4KB
         LOG_INF("Written %zu bytes", bytes_written);
@@ -88,22 +801,278 @@ int ota_manager_write_data(const uint8_t *data, size_t len)
     return 0;
 }
 
-int ota_manager_finish_update(void)
+size_t ota_manager_get_free_space(void)
 {
-    if (!update_in_progress) {
-        LOG_ERR("No update in progress");
+    return ota_ring_space();
+}
+
+int ota_manager_wait_writable(size_t len, k_timeout_t timeout)
+{
+    if (len > OTA_WRITE_BUF_SIZE) {
+        return -EINVAL;
+    }
+    
+    if (ota_ring_space() >= len) {
+        return 0;
+    }
+    
+    // Once stalled, resume only when the writer has made real room
+    size_t level = MAX(len, OTA_WRITE_RESUME_LEVEL);
+    
+    while (ota_ring_space() < level) {
+        if (write_error) {
+            return write_error;
+        }
+        
+        // The timeout bounds a stall, not the whole wait: a writer that
+        // programmed anything meanwhile is still draining
+        size_t flushed = bytes_flushed;
+        
+        if (k_sem_take(&writable_sem, timeout) && bytes_flushed == flushed) {
+            return -EAGAIN;
+        }
+    }
+    
+    return 0;
+}
+
+int ota_manager_repair_data(uint32_t owner, size_t offset, const uint8_t *data, size_t len)
+{
+    int ret = ota_check_owner(owner);
+    if (ret) {
+        return ret;
+    }
+    
+    if (len == 0) {
+        return 0;
+    }
+    
+    size_t limit = image_size ? image_size : flash_area->fa_size;
+    
+    if (offset >= limit || len > limit - offset) {
+        LOG_ERR("Repair data at %zu past the end of the image", offset);
+        return -EINVAL;
+    }
+    
+    size_t idx = offset / OTA_MANAGER_SECTOR_SIZE;
+    
+    if ((offset + len - 1) / OTA_MANAGER_SECTOR_SIZE != idx) {
+        LOG_ERR("Repair data spans sectors");
+        return -EINVAL;
+    }
+    
+    k_mutex_lock(&write_lock, K_FOREVER);
+    
+    // Refilled sectors are written in order; data up to the refill point
+    // is already in flash, which makes an interrupted or duplicated
+    // resend of the whole sector safe
+    size_t cursor = idx * OTA_MANAGER_SECTOR_SIZE + sectors[idx].fill;
+    
+    if (!atomic_test_bit(refill_sectors, idx)) {
+        LOG_ERR("Sector %zu does not need repair", idx);
+        ret = -EINVAL;
+    } else if (offset > cursor) {
+        LOG_ERR("Sector %zu repair must continue at %zu", idx, cursor);
+        ret = -EINVAL;
+    } else if (offset + len > cursor) {
+        ret = ota_write_at(cursor, data + (cursor - offset), offset + len - cursor);
+    }
+    
+    k_mutex_unlock(&write_lock);
+    
+    return ret;
+}
+
+int ota_manager_write_data_at(uint32_t owner, size_t offset, const uint8_t *data, size_t len)
+{
+    int ret = ota_check_owner(owner);
+    if (ret) {
+        return ret;
+    }
+    
+    if (len == 0) {
+        return 0;
+    }
+    
+    // Positioned writes bypass the buffer, so it must not hold older data
+    ret = ota_flush(OTA_FLUSH_TIMEOUT);
+    if (ret) {
+        return ret;
+    }
+    
+    k_mutex_lock(&write_lock, K_FOREVER);
+    ret = ota_write_at(offset, data, len);
+    k_mutex_unlock(&write_lock);
+    if (ret) {
+        return ret;
+    }
+    
+    bytes_written = MAX(bytes_written, offset + len);
+    bytes_flushed = bytes_written;
+    ota_session_chunk(len);
+    return 0;
+}
+
+int ota_manager_read_data(size_t offset, uint8_t *buf, size_t len)
+{
+    if (!flash_area) {
+        return -EINVAL;
+    }
+    
+    return flash_area_read(flash_area, offset, buf, len);
+}
+
+int ota_manager_set_image_size(uint32_t owner, size_t size)
+{
+    int ret = ota_check_owner(owner);
+    if (ret) {
+        return ret;
+    }
+    
+    if (size == 0 || size > flash_area->fa_size) {
+        return -EINVAL;
+    }
+    
+    image_size = size;
+    return 0;
+}
+
+size_t ota_manager_sector_count(void)
+{
+    return OTA_MAX_SECTORS;
+}
+
+bool ota_manager_sector_is_bad(size_t sector)
+{
+    if (sector >= OTA_MAX_SECTORS) {
+        return false;
+    }
+    
+    // A refilled sector waiting for readback needs no more data
+    return atomic_test_bit(refill_sectors, sector) &&
+           sectors[sector].fill < ota_sector_expected_len(sector);
+}
+
+uint16_t ota_manager_sector_generation(size_t sector)
+{
+    if (sector >= OTA_MAX_SECTORS) {
+        return 0;
+    }
+    
+    return sectors[sector].generation;
+}
+
+int ota_manager_set_wifi_profile(bool enabled)
+{
+    if (!IS_ENABLED(CONFIG_APP_OTA_WIFI_PROFILE)) {
+        return -ENOTSUP;
+    }
+    
+    // Applies from the next update; one in progress keeps its profile
+    wifi_profile_enabled = enabled;
+    LOG_INF("WiFi profile for OTA transfers %s", enabled ? "enabled" : "disabled");
+    
+#if defined(CONFIG_SETTINGS)
+    return storage_save_ota_wifi_profile(enabled);
+#else
+    return 0;
+#endif
+}
+
+bool ota_manager_get_wifi_profile(void)
+{
+    return wifi_profile_enabled;
+}
+
+int ota_manager_abort_update(uint32_t owner)
+{
+    if (owner != OTA_MANAGER_OWNER_ANY) {
+        int ret = ota_check_owner(owner);
+        if (ret) {
+            return ret;
+        }
+    } else if (!update_in_progress) {
         return -EINVAL;
     }
     
     update_in_progress = false;
     
+    // Drop whatever the writer has not programmed yet
+    k_mutex_lock(&write_lock, K_FOREVER);
+    k_spinlock_key_t key = k_spin_lock(&ring_lock);
+    ring_buf_reset(&write_ring);
+    k_spin_unlock(&ring_lock, key);
+    k_mutex_unlock(&write_lock);
+    
+#if defined(CONFIG_MCUMGR_GRP_IMG_UPLOAD_CHECK_HOOK)
+    smp_upload = false;
+    verify_deferred = false;
+#endif
+    
+    // Releases the slot, so only once nothing of this update is left
+    ota_session_end(false);
+    
+    LOG_WRN("OTA update aborted after %zu bytes", bytes_written);
+    return 0;
+}
+
+int ota_manager_finish_update(uint32_t owner)
+{
+    int ret = ota_check_owner(owner);
+    if (ret) {
+        return ret;
+    }
+    
     if (bytes_written == 0) {
+        ota_session_end(false);
         LOG_ERR("No data written");
         return -EINVAL;
     }
     
+    ret = ota_flush(OTA_FLUSH_TIMEOUT);
+    if (ret) {
+        LOG_ERR("Failed to program buffered data: %d", ret);
+        // A slow flush may still complete; a failed write will not
+        if (ret != -ETIMEDOUT) {
+            ota_manager_abort_update(owner);
+        }
+        return ret;
+    }
+    
+    // The image ends here, so the trailing partial sector can be verified
+    if (!image_size) {
+        size_t idx = (bytes_written - 1) / OTA_MANAGER_SECTOR_SIZE;
+        
+        k_mutex_lock(&write_lock, K_FOREVER);
+        image_size = bytes_written;
+        
+        if (image_size % OTA_CRC_GRANULE != 0) {
+            ota_fold_granule(idx);
+        } else if (image_size % OTA_MANAGER_SECTOR_SIZE != 0 &&
+                   sectors[idx].fill == ota_sector_expected_len(idx)) {
+            ota_queue_verify(idx);
+        }
+        k_mutex_unlock(&write_lock);
+    }
+    
+    ret = ota_wait_verified(OTA_VERIFY_TIMEOUT);
+    if (ret) {
+        LOG_ERR("Timed out waiting for readback verification");
+        return ret;
+    }
+    
+    // Only an image whose every sector is programmed and read back goes to
+    // MCUboot; otherwise keep the update open so those sectors can be resent
+    size_t bad = ota_flag_incomplete_sectors();
+    if (bad) {
+        LOG_WRN("%zu sector(s) need to be sent again", bad);
+        return -EAGAIN;
+    }
+    
+    ota_session_end(true);
+    
     // Mark the image for test (MCUboot will try it on next boot)
-    int ret = boot_request_upgrade(BOOT_UPGRADE_TEST);
+    ret = boot_request_upgrade(BOOT_UPGRADE_TEST);
     if (ret) {
         LOG_ERR("Failed to request upgrade: %d", ret);
         return ret;
@@ -113,17 +1082,327 @@ int ota_manager_finish_update(void)
     return 0;
 }
 
+struct ota_download {
+    uint32_t owner;
+    size_t offset;    // Image offset of the first byte requested
+    size_t received;
+    bool repair;      // Feed ota_manager_repair_data() instead of the stream
+    bool complete;
+    int result;
+};
+
+static int ota_parse_url(const char *url, char *host, size_t host_len,
+                         uint16_t *port, const char **path)
+{
+    // Plain HTTP only; peers and local servers do not terminate TLS
+    if (strncmp(url, "http://", 7) != 0) {
+        return -EINVAL;
+    }
+    
+    const char *start = url + 7;
+    const char *slash = strchr(start, '/');
+    const char *end = slash ? slash : start + strlen(start);
+    const char *colon = memchr(start, ':', end - start);
+    
+    *port = 80;
+    if (colon) {
+        *port = strtoul(colon + 1, NULL, 10);
+        end = colon;
+    }
+    
+    if (end == start || end - start >= host_len) {
+        return -EINVAL;
+    }
+    
+    memcpy(host, start, end - start);
+    host[end - start] = '\0';
+    *path = slash ? slash : "/";
+    return 0;
+}
+
+static int ota_connect(const char *host, uint16_t port)
+{
+    struct zsock_addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct zsock_addrinfo *res;
+    char port_str[6];
+    
+    snprintf(port_str, sizeof(port_str), "%u", port);
+    
+    if (zsock_getaddrinfo(host, port_str, &hints, &res)) {
+        LOG_ERR("Cannot resolve %s", host);
+        return -EHOSTUNREACH;
+    }
+    
+    int sock = zsock_socket(res->ai_family, res->ai_socktype, IPPROTO_TCP);
+    if (sock >= 0 && zsock_connect(sock, res->ai_addr, res->ai_addrlen) < 0) {
+        int err = -errno;
+        
+        zsock_close(sock);
+        sock = err;
+    }
+    
+    zsock_freeaddrinfo(res);
+    return sock;
+}
+
+static int ota_http_response_cb(struct http_response *rsp,
+                                enum http_final_call final_data, void *user_data)
+{
+    struct ota_download *dl = user_data;
+    
+    if (dl->result) {
+        return dl->result;
+    }
+    
+    // Anything but the exact range asked for would corrupt the image
+    int expected = (dl->offset || dl->repair) ? 206 : 200;
+    if (rsp->http_status_code != expected) {
+        LOG_ERR("Unexpected HTTP status %d", rsp->http_status_code);
+        dl->result = -EIO;
+        return dl->result;
+    }
+    
+    if (rsp->body_found && rsp->body_frag_len > 0) {
+        if (dl->repair) {
+            dl->result = ota_manager_repair_data(dl->owner, dl->offset + dl->received,
+                                                 rsp->body_frag_start,
+                                                 rsp->body_frag_len);
+        } else {
+            dl->result = ota_manager_wait_writable(rsp->body_frag_len, OTA_FLUSH_TIMEOUT);
+            if (!dl->result) {
+                dl->result = ota_manager_write_data(dl->owner, rsp->body_frag_start,
+                                                    rsp->body_frag_len);
+            }
+        }
+        dl->received += rsp->body_frag_len;
+    }
+    
+    if (final_data == HTTP_DATA_FINAL) {
+        dl->complete = rsp->message_complete;
+    }
+    
+    return dl->result;
+}
+
+// Fetches [offset, last] of the image, or everything from offset if last is 0
+static int ota_fetch(const char *host, uint16_t port, const char *path,
+                     struct ota_download *dl, size_t last)
+{
+    static uint8_t recv_buf[OTA_HTTP_RECV_BUF_SIZE];
+    char range[48];
+    const char *headers[] = { range, NULL };
+    
+    if (last) {
+        snprintf(range, sizeof(range), "Range: bytes=%zu-%zu\r\n", dl->offset, last);
+    } else {
+        snprintf(range, sizeof(range), "Range: bytes=%zu-\r\n", dl->offset);
+    }
+    
+    int sock = ota_connect(host, port);
+    if (sock < 0) {
+        return sock;
+    }
+    
+    struct http_request req = {
+        .method = HTTP_GET,
+        .url = path,
+        .host = host,
+        .protocol = "HTTP/1.1",
+        .header_fields = (dl->offset || last) ? headers : NULL,
+        .response = ota_http_response_cb,
+        .recv_buf = recv_buf,
+        .recv_buf_len = sizeof(recv_buf),
+    };
+    
+    int ret = http_client_req(sock, &req, OTA_HTTP_TIMEOUT_MS, dl);
+    zsock_close(sock);
+    
+    if (dl->result) {
+        return dl->result;
+    }
+    
+    if (ret < 0 || !dl->complete) {
+        return -ECONNRESET;
+    }
+    
+    return 0;
+}
+
+// Re-downloads just the sectors the readback verifier rejected
+static int ota_fetch_bad_sectors(uint32_t owner, const char *host, uint16_t port,
+                                 const char *path)
+{
+    for (size_t i = 0; i * OTA_MANAGER_SECTOR_SIZE < image_size; i++) {
+        if (!ota_manager_sector_is_bad(i)) {
+            continue;
+        }
+        
+        struct ota_download dl = {
+            .owner = owner,
+            .offset = i * OTA_MANAGER_SECTOR_SIZE,
+            .repair = true,
+        };
+        size_t last = dl.offset + ota_sector_expected_len(i) - 1;
+        
+        int ret = ota_fetch(host, port, path, &dl, last);
+        if (ret) {
+            return ret;
+        }
+    }
+    
+    return 0;
+}
+
 int ota_manager_update_from_url(const char *url)
 {
-    // This is a simplified implementation
-    // In a real implementation, you would:
-    // 1. Parse the URL
-    // 2. Create HTTP client
-    // 3. Download the firmware
-    // 4. Write it using the functions above
+    char host[OTA_HOST_MAX_LEN];
+    const char *path;
+    uint16_t port;
+    uint32_t owner;
+    
+    int ret = ota_parse_url(url, host, sizeof(host), &port, &path);
+    if (ret) {
+        LOG_ERR("Unsupported URL: %s", url);
+        return ret;
+    }
+    
+    ret = ota_manager_start_update(&owner);
+    if (ret) {
+        return ret;
+    }
+    
+    LOG_INF("Downloading update from %s", url);
+    
+    // A dropped connection resumes with a Range request where it stopped
+    for (int attempt = 0; attempt < OTA_HTTP_RETRIES; attempt++) {
+        struct ota_download dl = { .owner = owner, .offset = bytes_written };
+        
+        ret = ota_fetch(host, port, path, &dl, 0);
+        if (ret == 0 || dl.result) {
+            break;
+        }
+        
+        LOG_WRN("Download interrupted at %zu bytes: %d", bytes_written, ret);
+    }
+    
+    if (ret == 0) {
+        ret = ota_manager_finish_update(owner);
+    }
+    
+    for (int attempt = 0; ret == -EAGAIN && attempt < OTA_HTTP_RETRIES; attempt++) {
+        ret = ota_fetch_bad_sectors(owner, host, port, path);
+        if (ret == 0) {
+            ret = ota_manager_finish_update(owner);
+        }
+    }
+    
+    if (ret) {
+        ota_manager_abort_update(owner);
+    }
     
-    LOG_INF("URL update not fully implemented: %s", url);
-    return -ENOSYS;
+    return ret;
+}
+
+int ota_manager_update_from_url_async(const char *url)
+{
+    if (strlen(url) >= sizeof(pull_url)) {
+        return -EINVAL;
+    }
+    
+    if (!atomic_cas(&pull_pending, 0, 1)) {
+        return -EBUSY;
+    }
+    
+    strcpy(pull_url, url);
+    k_sem_give(&pull_sem);
+    return 0;
+}
+
+static void ota_download_thread(void *p1, void *p2, void *p3)
+{
+    while (1) {
+        k_sem_take(&pull_sem, K_FOREVER);
+        
+        int ret = ota_manager_update_from_url(pull_url);
+        LOG_INF("Update from %s finished: %d", pull_url, ret);
+        
+        atomic_set(&pull_pending, 0);
+    }
+}
+
+K_THREAD_DEFINE(ota_download_tid, OTA_DOWNLOAD_STACK_SIZE, ota_download_thread,
+                NULL, NULL, NULL, OTA_DOWNLOAD_PRIORITY, 0, 0);
+
+int ota_manager_get_running_image_size(size_t *size)
+{
+    uint8_t hdr[16];
+    uint8_t info[4];
+    
+    if (primary_image_size) {
+        *size = primary_image_size;
+        return 0;
+    }
+    
+    if (!primary_area) {
+        int ret = flash_area_open(FLASH_AREA_IMAGE_PRIMARY, &primary_area);
+        if (ret) {
+            LOG_ERR("Failed to open primary slot: %d", ret);
+            return ret;
+        }
+    }
+    
+    int ret = flash_area_read(primary_area, 0, hdr, sizeof(hdr));
+    if (ret) {
+        return ret;
+    }
+    
+    if (sys_get_le32(hdr) != MCUBOOT_IMAGE_MAGIC) {
+        return -ENOENT;
+    }
+    
+    // Header, then the image, then the (optional protected and) regular TLVs
+    size_t off = sys_get_le16(hdr + 8) + sys_get_le32(hdr + 12);
+    
+    ret = flash_area_read(primary_area, off, info, sizeof(info));
+    if (ret) {
+        return ret;
+    }
+    
+    if (sys_get_le16(info) == MCUBOOT_TLV_PROT_INFO_MAGIC) {
+        off += sys_get_le16(info + 2);
+        
+        ret = flash_area_read(primary_area, off, info, sizeof(info));
+        if (ret) {
+            return ret;
+        }
+    }
+    
+    if (sys_get_le16(info) != MCUBOOT_TLV_INFO_MAGIC) {
+        return -EINVAL;
+    }
+    
+    primary_image_size = off + sys_get_le16(info + 2);
+    *size = primary_image_size;
+    return 0;
+}
+
+int ota_manager_read_running_image(size_t offset, uint8_t *buf, size_t len)
+{
+    size_t size;
+    
+    int ret = ota_manager_get_running_image_size(&size);
+    if (ret) {
+        return ret;
+    }
+    
+    if (offset + len > size) {
+        return -EINVAL;
+    }
+    
+    return flash_area_read(primary_area, offset, buf, len);
 }
 
 int ota_manager_get_status(char *buf, size_t buf_len)
@@ -133,11 +1412,44 @@ int ota_manager_get_status(char *buf, size_t buf_len)
     }
     
     if (update_in_progress) {
-        snprintf(buf, buf_len, 
-                "{\"status\":\"updating\",\"bytes_written\":%zu}", 
-                bytes_written);
+        int len = snprintf(buf, buf_len,
+                           "{\"status\":\"updating\",\"bytes_written\":%zu,"
+                           "\"bytes_programmed\":%zu,\"buffer_free\":%zu,"
+                           "\"sector_size\":%d,\"verify_pending\":%d,"
+                           "\"bad_sectors\":[",
+                           bytes_written, bytes_flushed, ota_ring_space(),
+                           OTA_MANAGER_SECTOR_SIZE, (int)atomic_get(&verify_pending));
+        bool first = true;
+        
+        for (size_t i = 0; i < OTA_MAX_SECTORS && len > 0 && len < buf_len; i++) {
+            if (ota_manager_sector_is_bad(i)) {
+                len += snprintf(buf + len, buf_len - len, "%s%zu",
+                                first ? "" : ",", i);
+                first = false;
+            }
+        }
+        
+        if (len > 0 && len < buf_len) {
+            snprintf(buf + len, buf_len - len, "]}");
+        }
     } else {
-        snprintf(buf, buf_len, "{\"status\":\"ready\"}");
+        int len = snprintf(buf, buf_len,
+                           "{\"status\":\"ready\",\"wifi_profile_enabled\":%s,"
+                           "\"last_transfer\":",
+                           wifi_profile_enabled ? "true" : "false");
+        
+        if (len > 0 && len < buf_len) {
+            len += ota_transfer_json(buf + len, buf_len - len, &transfer_history[0]);
+        }
+        if (len > 0 && len < buf_len) {
+            len += snprintf(buf + len, buf_len - len, ",\"previous_transfer\":");
+        }
+        if (len > 0 && len < buf_len) {
+            len += ota_transfer_json(buf + len, buf_len - len, &transfer_history[1]);
+        }
+        if (len > 0 && len < buf_len) {
+            snprintf(buf + len, buf_len - len, "}");
+        }
     }
     
     return 0;
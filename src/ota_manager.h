@@ -2,12 +2,52 @@
 #define OTA_MANAGER_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+
+// Granularity of the readback verification and of sector re-requests
+#define OTA_MANAGER_SECTOR_SIZE 4096
+
+// Where a device with CONFIG_APP_OTA_PEER_SERVE offers its running image
+#define OTA_MANAGER_PEER_IMAGE_PATH "/api/ota/image"
+
+// Never handed out; lets ota_manager_abort_update() end any update, for
+// requests that cancel one regardless of who started it
+#define OTA_MANAGER_OWNER_ANY 0
 
 int ota_manager_init(void);
-int ota_manager_start_update(void);
-int ota_manager_write_data(const uint8_t *data, size_t len);
-int ota_manager_finish_update(void);
+// Returns the owner token the writes, finish and abort of this update must
+// pass; once the update is aborted or taken over they fail with -EPERM
+int ota_manager_start_update(uint32_t *owner);
+
+// ota_manager_write_data() only buffers: it returns -EAGAIN when the chunk
+// does not fit, and ota_manager_wait_writable() blocks until it does, with
+// hysteresis so a stalled producer resumes only once half the buffer is free.
+// It gives up with -EAGAIN only if the writer programs nothing for timeout.
+int ota_manager_write_data(uint32_t owner, const uint8_t *data, size_t len);
+size_t ota_manager_get_free_space(void);
+int ota_manager_wait_writable(size_t len, k_timeout_t timeout);
+
+int ota_manager_repair_data(uint32_t owner, size_t offset, const uint8_t *data, size_t len);
+int ota_manager_write_data_at(uint32_t owner, size_t offset, const uint8_t *data, size_t len);
+int ota_manager_read_data(size_t offset, uint8_t *buf, size_t len);
+int ota_manager_set_image_size(uint32_t owner, size_t size);
+size_t ota_manager_sector_count(void);
+bool ota_manager_sector_is_bad(size_t sector);
+// Changes each time a rejected sector is erased, so data a caller believes
+// is in flash can be checked without holding the write lock
+uint16_t ota_manager_sector_generation(size_t sector);
+// Whether transfers run with the WiFi throughput profile; persisted, and
+// -ENOTSUP without CONFIG_APP_OTA_WIFI_PROFILE
+int ota_manager_set_wifi_profile(bool enabled);
+bool ota_manager_get_wifi_profile(void);
+int ota_manager_abort_update(uint32_t owner);
+int ota_manager_finish_update(uint32_t owner);
 int ota_manager_update_from_url(const char *url);
+int ota_manager_update_from_url_async(const char *url);
+int ota_manager_get_running_image_size(size_t *size);
+int ota_manager_read_running_image(size_t offset, uint8_t *buf, size_t len);
 int ota_manager_get_status(char *buf, size_t buf_len);
 
 #endif
\ No newline at end of file
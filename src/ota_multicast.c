@@ -0,0 +1,594 @@
+#include <zephyr/kernel.h>
+#include <zephyr/dfu/mcuboot.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/net/net_if.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+
+#include "ota_manager.h"
+#include "ota_multicast.h"
+#if defined(CONFIG_SETTINGS)
+#include "storage.h"
+#endif
+
+LOG_MODULE_REGISTER(ota_multicast);
+
+// Every datagram starts with this little-endian header:
+//   0  magic       "OTAM"
+//   4  session     u16, changes for every image the sender distributes
+//   6  type        u8, enum ota_mcast_type
+//   7  group_size  u8, data blocks covered by one XOR parity block
+//   8  image_size  u32
+//  12  block_size  u16, 256, 512 or 1024 so no block spans two sectors
+//  14  reserved    u16
+//  16  index       u32, block index (DATA), group index (PARITY) or
+//                  number of block indices that follow (NACK)
+#define OTA_MCAST_MAGIC 0x4d41544f
+#define OTA_MCAST_HDR_LEN 20
+
+#define OTA_MCAST_BLOCK_MAX CONFIG_APP_OTA_MULTICAST_BLOCK_MAX
+#define OTA_MCAST_BLOCK_ALIGN 256
+#define OTA_MCAST_MAX_BLOCKS (FIXED_PARTITION_SIZE(slot1_partition) / OTA_MCAST_BLOCK_ALIGN)
+#define OTA_MCAST_MAX_SECTORS (FIXED_PARTITION_SIZE(slot1_partition) / OTA_MANAGER_SECTOR_SIZE)
+#define OTA_MCAST_PARITY_SLOTS 4
+#define OTA_MCAST_NACK_MAX 128  // Block indices per repair request
+#define OTA_MCAST_REPAIR_TIMEOUT_MS 2000
+#define OTA_MCAST_REPAIR_RETRIES 10
+// A session whose sender goes quiet for this long, before or after END,
+// gives the slot back; repair retries run out well within it
+#define OTA_MCAST_IDLE_TIMEOUT_MS 30000
+#define OTA_MCAST_STACK_SIZE 3072
+#define OTA_MCAST_PRIORITY 7
+
+enum ota_mcast_type {
+    OTA_MCAST_DATA = 0,
+    OTA_MCAST_PARITY = 1,
+    OTA_MCAST_END = 2,     // Multicast phase over, receivers report gaps
+    OTA_MCAST_NACK = 3,    // Receiver to sender: blocks still missing
+};
+
+struct ota_mcast_hdr {
+    uint16_t session;
+    uint8_t type;
+    uint8_t group_size;
+    uint32_t image_size;
+    uint16_t block_size;
+    uint32_t index;
+};
+
+struct ota_mcast_parity {
+    bool valid;
+    uint32_t group;
+    uint8_t data[OTA_MCAST_BLOCK_MAX];
+};
+
+static struct {
+    bool active;
+    bool repairing;
+    uint32_t owner;      // ota_manager token of this session's update
+    uint16_t id;
+    uint8_t group_size;
+    uint16_t block_size;
+    uint32_t image_size;
+    uint32_t blocks;
+    uint32_t present;    // Blocks currently held in flash
+    uint32_t received;
+    uint32_t recovered;  // Blocks rebuilt from parity
+    uint32_t repaired;   // Blocks received by unicast after END
+    int retries;
+    int64_t last_activity;
+    struct sockaddr_in source;
+} session;
+
+static uint32_t have[(OTA_MCAST_MAX_BLOCKS + 31) / 32];
+// Sector generations the have[] bits were set under; ota_manager bumps one
+// when the verifier erases that sector, and its blocks are then gone
+static uint16_t sector_gen[OTA_MCAST_MAX_SECTORS];
+static struct ota_mcast_parity parity_cache[OTA_MCAST_PARITY_SLOTS];
+static size_t parity_next;
+
+static uint8_t rx_buf[OTA_MCAST_HDR_LEN + OTA_MCAST_BLOCK_MAX];
+static uint8_t tx_buf[OTA_MCAST_HDR_LEN + OTA_MCAST_NACK_MAX * sizeof(uint32_t)];
+static uint8_t acc_buf[OTA_MCAST_BLOCK_MAX];
+static uint8_t read_buf[OTA_MCAST_BLOCK_MAX];
+
+static int sock = -1;
+// Last session taken, persisted so it is not taken again after the reboot
+static int done_session = -1;
+
+K_THREAD_STACK_DEFINE(ota_mcast_stack, OTA_MCAST_STACK_SIZE);
+static struct k_thread ota_mcast_thread;
+
+static bool have_block(uint32_t idx)
+{
+    return have[idx / 32] & BIT(idx % 32);
+}
+
+static void set_block(uint32_t idx, bool present)
+{
+    if (present == have_block(idx)) {
+        return;
+    }
+    
+    if (present) {
+        have[idx / 32] |= BIT(idx % 32);
+        session.present++;
+    } else {
+        have[idx / 32] &= ~BIT(idx % 32);
+        session.present--;
+    }
+}
+
+static size_t block_len(uint32_t idx)
+{
+    return MIN(session.block_size, session.image_size - idx * session.block_size);
+}
+
+static size_t block_sector(uint32_t idx)
+{
+    return (size_t)idx * session.block_size / OTA_MANAGER_SECTOR_SIZE;
+}
+
+// Whether the block is in flash, forgetting every block of a sector that
+// failed readback and was erased since they were written
+static bool block_present(uint32_t idx)
+{
+    size_t sector = block_sector(idx);
+    uint16_t gen = ota_manager_sector_generation(sector);
+    
+    if (gen != sector_gen[sector]) {
+        uint32_t per_sector = OTA_MANAGER_SECTOR_SIZE / session.block_size;
+        uint32_t first = sector * per_sector;
+        uint32_t last = MIN(first + per_sector, session.blocks);
+        
+        LOG_WRN("Sector %zu failed readback, its blocks are needed again", sector);
+        for (uint32_t i = first; i < last; i++) {
+            set_block(i, false);
+        }
+        sector_gen[sector] = gen;
+    }
+    
+    return have_block(idx);
+}
+
+static bool parse_hdr(const uint8_t *buf, size_t len, struct ota_mcast_hdr *hdr)
+{
+    if (len < OTA_MCAST_HDR_LEN || sys_get_le32(buf) != OTA_MCAST_MAGIC) {
+        return false;
+    }
+    
+    hdr->session = sys_get_le16(buf + 4);
+    hdr->type = buf[6];
+    hdr->group_size = buf[7];
+    hdr->image_size = sys_get_le32(buf + 8);
+    hdr->block_size = sys_get_le16(buf + 12);
+    hdr->index = sys_get_le32(buf + 16);
+    return true;
+}
+
+static int session_start(const struct ota_mcast_hdr *hdr)
+{
+    if (hdr->block_size == 0 || hdr->block_size > OTA_MCAST_BLOCK_MAX ||
+        hdr->block_size % OTA_MCAST_BLOCK_ALIGN != 0 ||
+        OTA_MANAGER_SECTOR_SIZE % hdr->block_size != 0 || hdr->group_size == 0 ||
+        hdr->image_size == 0 ||
+        hdr->image_size > (size_t)OTA_MCAST_MAX_BLOCKS * OTA_MCAST_BLOCK_ALIGN) {
+        LOG_WRN("Ignoring session %u with unusable parameters", hdr->session);
+        return -EINVAL;
+    }
+    
+    uint32_t owner;
+    int ret = ota_manager_start_update(&owner);
+    if (ret) {
+        return ret;
+    }
+    
+    ota_manager_set_image_size(owner, hdr->image_size);
+    
+    memset(&session, 0, sizeof(session));
+    memset(have, 0, sizeof(have));
+    memset(sector_gen, 0, sizeof(sector_gen));
+    memset(parity_cache, 0, sizeof(parity_cache));
+    session.active = true;
+    session.owner = owner;
+    session.id = hdr->session;
+    session.group_size = hdr->group_size;
+    session.block_size = hdr->block_size;
+    session.image_size = hdr->image_size;
+    session.blocks = DIV_ROUND_UP(hdr->image_size, hdr->block_size);
+    
+    LOG_INF("Joined multicast session %u: %u bytes in %u blocks, 1 parity per %u",
+            session.id, session.image_size, session.blocks, session.group_size);
+    return 0;
+}
+
+static int write_block(uint32_t idx, const uint8_t *data)
+{
+    int ret = ota_manager_write_data_at(session.owner, (size_t)idx * session.block_size,
+                                        data, block_len(idx));
+    if (ret == -EPERM) {
+        LOG_WRN("Session %u lost its update to another transfer", session.id);
+        session.active = false;
+    }
+    if (ret) {
+        return ret;
+    }
+    
+    set_block(idx, true);
+    session.received++;
+    return 0;
+}
+
+static uint32_t group_missing(uint32_t group, uint32_t *missing_idx)
+{
+    uint32_t first = group * session.group_size;
+    uint32_t last = MIN(first + session.group_size, session.blocks);
+    uint32_t missing = 0;
+    
+    for (uint32_t i = first; i < last; i++) {
+        if (!block_present(i)) {
+            *missing_idx = i;
+            missing++;
+        }
+    }
+    
+    return missing;
+}
+
+// XOR parity covers a whole group, so the one missing block is the parity
+// XOR every block already in flash (short blocks count as zero-padded)
+static int recover_block(uint32_t group, const uint8_t *parity, uint32_t missing_idx)
+{
+    uint32_t first = group * session.group_size;
+    uint32_t last = MIN(first + session.group_size, session.blocks);
+    
+    memcpy(acc_buf, parity, session.block_size);
+    
+    for (uint32_t i = first; i < last; i++) {
+        if (i == missing_idx) {
+            continue;
+        }
+        
+        size_t len = block_len(i);
+        int ret = ota_manager_read_data((size_t)i * session.block_size, read_buf, len);
+        if (ret) {
+            return ret;
+        }
+        
+        for (size_t j = 0; j < len; j++) {
+            acc_buf[j] ^= read_buf[j];
+        }
+    }
+    
+    // A sibling erased while it was being read would rebuild garbage
+    if (group_missing(group, &missing_idx) != 1) {
+        return -EAGAIN;
+    }
+    
+    int ret = write_block(missing_idx, acc_buf);
+    if (ret == 0) {
+        session.recovered++;
+        session.received--;
+        LOG_DBG("Recovered block %u from parity", missing_idx);
+    }
+    
+    return ret;
+}
+
+static void on_parity(uint32_t group, const uint8_t *parity)
+{
+    uint32_t missing_idx;
+    uint32_t missing = group_missing(group, &missing_idx);
+    
+    if (missing == 1) {
+        recover_block(group, parity, missing_idx);
+    } else if (missing > 1) {
+        // Keep it until enough of the group has arrived to use it
+        struct ota_mcast_parity *slot = &parity_cache[parity_next];
+        
+        parity_next = (parity_next + 1) % OTA_MCAST_PARITY_SLOTS;
+        slot->valid = true;
+        slot->group = group;
+        memcpy(slot->data, parity, session.block_size);
+    }
+}
+
+static void on_data(uint32_t idx, const uint8_t *data)
+{
+    if (block_present(idx)) {
+        return;
+    }
+    
+    if (write_block(idx, data)) {
+        return;
+    }
+    
+    if (session.repairing) {
+        session.repaired++;
+    }
+    
+    uint32_t group = idx / session.group_size;
+    
+    for (size_t i = 0; i < OTA_MCAST_PARITY_SLOTS; i++) {
+        struct ota_mcast_parity *slot = &parity_cache[i];
+        uint32_t missing_idx;
+        
+        if (!slot->valid || slot->group != group) {
+            continue;
+        }
+        
+        if (group_missing(group, &missing_idx) == 1) {
+            recover_block(group, slot->data, missing_idx);
+        }
+        
+        if (group_missing(group, &missing_idx) == 0) {
+            slot->valid = false;
+        }
+    }
+}
+
+static void send_nack(const uint32_t *indices, uint32_t count)
+{
+    sys_put_le32(OTA_MCAST_MAGIC, tx_buf);
+    sys_put_le16(session.id, tx_buf + 4);
+    tx_buf[6] = OTA_MCAST_NACK;
+    tx_buf[7] = session.group_size;
+    sys_put_le32(session.image_size, tx_buf + 8);
+    sys_put_le16(session.block_size, tx_buf + 12);
+    sys_put_le16(0, tx_buf + 14);
+    sys_put_le32(count, tx_buf + 16);
+    
+    for (uint32_t i = 0; i < count; i++) {
+        sys_put_le32(indices[i], tx_buf + OTA_MCAST_HDR_LEN + i * sizeof(uint32_t));
+    }
+    
+    zsock_sendto(sock, tx_buf, OTA_MCAST_HDR_LEN + count * sizeof(uint32_t), 0,
+                 (struct sockaddr *)&session.source, sizeof(session.source));
+}
+
+static void session_complete(void)
+{
+    int ret = ota_manager_finish_update(session.owner);
+    
+    // -EAGAIN: sectors failed readback and their blocks are missing again.
+    // -ETIMEDOUT: programming or readback is still running. Either way the
+    // update stays open and the next repair round tries again.
+    if (ret == -EAGAIN || ret == -ETIMEDOUT) {
+        return;
+    }
+    
+    session.active = false;
+    
+    if (ret) {
+        // Release the slot but stay silent, so the sender does not count
+        // this receiver as updated
+        LOG_ERR("Session %u failed: %d", session.id, ret);
+        ota_manager_abort_update(session.owner);
+        return;
+    }
+    
+    LOG_INF("Session %u complete: %u multicast, %u from parity, %u repaired",
+            session.id, session.received, session.recovered, session.repaired);
+    
+    // An empty NACK tells the sender this receiver is done
+    send_nack(NULL, 0);
+    done_session = session.id;
+#if defined(CONFIG_SETTINGS)
+    storage_save_ota_mcast_session(session.id);
+#endif
+}
+
+// Reports the remaining gaps to the sender, which unicasts just those blocks
+static void request_repair(void)
+{
+    static uint32_t missing[OTA_MCAST_NACK_MAX];
+    uint32_t count = 0;
+    
+    for (uint32_t i = 0; i < session.blocks && count < OTA_MCAST_NACK_MAX; i++) {
+        if (!block_present(i)) {
+            missing[count++] = i;
+        }
+    }
+    
+    if (count == 0) {
+        session_complete();
+        
+        // Finishing may have uncovered sectors that need re-sending
+        if (!session.active) {
+            return;
+        }
+        
+        for (uint32_t i = 0; i < session.blocks && count < OTA_MCAST_NACK_MAX; i++) {
+            if (!block_present(i)) {
+                missing[count++] = i;
+            }
+        }
+        
+        // Still finishing; an empty NACK would report success, so wait for
+        // the next round
+        if (count == 0) {
+            return;
+        }
+    }
+    
+    LOG_INF("Requesting %u missing block(s)", count);
+    send_nack(missing, count);
+}
+
+static void handle_packet(const uint8_t *buf, size_t len, const struct sockaddr_in *from)
+{
+    struct ota_mcast_hdr hdr;
+    
+    if (!parse_hdr(buf, len, &hdr) || hdr.type == OTA_MCAST_NACK) {
+        return;
+    }
+    
+    if (session.active) {
+        // Another session waits until this one ends or goes idle
+        if (hdr.session != session.id) {
+            return;
+        }
+    } else {
+        // Late traffic for an image this device already took, possibly
+        // before rebooting into it
+        if (hdr.session == done_session) {
+            return;
+        }
+        
+        // Until the running image is confirmed, slot1 holds the one
+        // MCUboot reverts to
+        if (!boot_is_img_confirmed()) {
+            return;
+        }
+        
+        if (session_start(&hdr)) {
+            return;
+        }
+    }
+    
+    session.last_activity = k_uptime_get();
+    session.retries = 0;
+    
+    const uint8_t *payload = buf + OTA_MCAST_HDR_LEN;
+    size_t payload_len = len - OTA_MCAST_HDR_LEN;
+    
+    switch (hdr.type) {
+    case OTA_MCAST_DATA:
+        if (hdr.index < session.blocks && payload_len >= block_len(hdr.index)) {
+            on_data(hdr.index, payload);
+        }
+        break;
+    case OTA_MCAST_PARITY:
+        if (hdr.index * session.group_size < session.blocks &&
+            payload_len >= session.block_size) {
+            on_parity(hdr.index, payload);
+        }
+        break;
+    case OTA_MCAST_END:
+        session.source = *from;
+        session.repairing = true;
+        session.retries = 0;
+        request_repair();
+        break;
+    default:
+        break;
+    }
+}
+
+static void ota_multicast_thread(void *p1, void *p2, void *p3)
+{
+    struct zsock_pollfd fds = { .fd = sock, .events = ZSOCK_POLLIN };
+    
+    while (1) {
+        // A sender that stopped without END, or another session's traffic
+        // masking a silent one, would otherwise hold the slot for good
+        if (session.active &&
+            k_uptime_get() - session.last_activity > OTA_MCAST_IDLE_TIMEOUT_MS) {
+            LOG_ERR("Session %u abandoned, sender went quiet", session.id);
+            ota_manager_abort_update(session.owner);
+            session.active = false;
+        }
+        
+        int timeout = -1;
+        
+        if (session.active) {
+            timeout = session.repairing ? OTA_MCAST_REPAIR_TIMEOUT_MS :
+                                          OTA_MCAST_IDLE_TIMEOUT_MS;
+        }
+        
+        int ret = zsock_poll(&fds, 1, timeout);
+        
+        if (ret < 0) {
+            LOG_ERR("Poll failed: %d", errno);
+            k_sleep(K_MSEC(100));
+            continue;
+        }
+        
+        if (ret == 0 && !session.repairing) {
+            continue;
+        }
+        
+        if (ret == 0) {
+            // Repair traffic stopped; ask again or give up
+            if (++session.retries > OTA_MCAST_REPAIR_RETRIES) {
+                LOG_ERR("Session %u abandoned, sender stopped repairing", session.id);
+                ota_manager_abort_update(session.owner);
+                session.active = false;
+            } else {
+                request_repair();
+            }
+            continue;
+        }
+        
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t len = zsock_recvfrom(sock, rx_buf, sizeof(rx_buf), 0,
+                                     (struct sockaddr *)&from, &from_len);
+        if (len <= 0) {
+            continue;
+        }
+        
+        handle_packet(rx_buf, len, &from);
+        
+        // Unicast repairs that close the last gap finish the session
+        if (session.active && session.repairing && session.present == session.blocks) {
+            request_repair();
+        }
+    }
+}
+
+int ota_multicast_start(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_APP_OTA_MULTICAST_PORT),
+    };
+    struct ip_mreqn mreqn = {0};
+    
+    if (sock >= 0) {
+        return -EALREADY;
+    }
+    
+    sock = zsock_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        LOG_ERR("Failed to create socket: %d", errno);
+        return -errno;
+    }
+    
+    if (zsock_bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOG_ERR("Failed to bind port %d: %d", CONFIG_APP_OTA_MULTICAST_PORT, errno);
+        zsock_close(sock);
+        sock = -1;
+        return -errno;
+    }
+    
+    zsock_inet_pton(AF_INET, CONFIG_APP_OTA_MULTICAST_GROUP, &mreqn.imr_multiaddr);
+    mreqn.imr_ifindex = net_if_get_by_iface(net_if_get_default());
+    
+    if (zsock_setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreqn, sizeof(mreqn)) < 0) {
+        LOG_ERR("Failed to join %s: %d", CONFIG_APP_OTA_MULTICAST_GROUP, errno);
+        zsock_close(sock);
+        sock = -1;
+        return -errno;
+    }
+    
+#if defined(CONFIG_SETTINGS)
+    uint16_t last_session;
+    
+    if (storage_load_ota_mcast_session(&last_session) == 0) {
+        done_session = last_session;
+    }
+#endif
+    
+    k_thread_create(&ota_mcast_thread, ota_mcast_stack,
+                    K_THREAD_STACK_SIZEOF(ota_mcast_stack),
+                    ota_multicast_thread, NULL, NULL, NULL,
+                    OTA_MCAST_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(&ota_mcast_thread, "ota_multicast");
+    
+    LOG_INF("Listening for multicast OTA on %s:%d",
+            CONFIG_APP_OTA_MULTICAST_GROUP, CONFIG_APP_OTA_MULTICAST_PORT);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,6 @@
+#ifndef OTA_MULTICAST_H
+#define OTA_MULTICAST_H
+
+int ota_multicast_start(void);
+
+#endif
\ No newline at end of file
@@ -8,6 +8,9 @@
 LOG_MODULE_REGISTER(storage);
 
 #define WIFI_CREDS_KEY "wifi/creds"
+#define OTA_WIFI_PROFILE_KEY "ota/wifi_profile"
+#define OTA_HISTORY_KEY "ota/history"
+#define OTA_MCAST_SESSION_KEY "ota/mcast_done"
 
 int storage_init(void)
 {
@@ -71,4 +74,87 @@ int storage_clear_wifi_credentials(void)
     }
     
     return ret;
-}
\ No newline at end of file
+}
+
+int storage_save_ota_wifi_profile(bool enabled)
+{
+    uint8_t value = enabled;
+    
+    int ret = settings_save_one(OTA_WIFI_PROFILE_KEY, &value, sizeof(value));
+    if (ret) {
+        LOG_ERR("Failed to save OTA WiFi profile setting: %d", ret);
+    }
+    
+    return ret;
+}
+
+int storage_load_ota_wifi_profile(bool *enabled)
+{
+    uint8_t value;
+    
+    if (!enabled) {
+        return -EINVAL;
+    }
+    
+    ssize_t len = settings_load_one(OTA_WIFI_PROFILE_KEY, &value, sizeof(value));
+    if (len != sizeof(value)) {
+        return len < 0 ? len : -ENOENT;
+    }
+    
+    *enabled = value != 0;
+    return 0;
+}
+
+int storage_save_ota_history(const void *history, size_t len)
+{
+    if (!history) {
+        return -EINVAL;
+    }
+    
+    int ret = settings_save_one(OTA_HISTORY_KEY, history, len);
+    if (ret) {
+        LOG_ERR("Failed to save OTA transfer history: %d", ret);
+    }
+    
+    return ret;
+}
+
+int storage_load_ota_history(void *history, size_t len)
+{
+    if (!history) {
+        return -EINVAL;
+    }
+    
+    ssize_t loaded = settings_load_one(OTA_HISTORY_KEY, history, len);
+    if (loaded != (ssize_t)len) {
+        // Missing, or written by a build with a different layout
+        memset(history, 0, len);
+        return loaded < 0 ? loaded : -ENOENT;
+    }
+    
+    return 0;
+}
+
+int storage_save_ota_mcast_session(uint16_t session)
+{
+    int ret = settings_save_one(OTA_MCAST_SESSION_KEY, &session, sizeof(session));
+    if (ret) {
+        LOG_ERR("Failed to save multicast session: %d", ret);
+    }
+    
+    return ret;
+}
+
+int storage_load_ota_mcast_session(uint16_t *session)
+{
+    if (!session) {
+        return -EINVAL;
+    }
+    
+    ssize_t len = settings_load_one(OTA_MCAST_SESSION_KEY, session, sizeof(*session));
+    if (len != sizeof(*session)) {
+        return len < 0 ? len : -ENOENT;
+    }
+    
+    return 0;
+}
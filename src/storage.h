@@ -8,4 +8,15 @@ int storage_save_wifi_credentials(const struct wifi_credentials *creds);
 int storage_load_wifi_credentials(struct wifi_credentials *creds);
 int storage_clear_wifi_credentials(void);
 
+// Persisted so the OTA transfer figures survive the reboot into the new
+// image and the WiFi profile choice holds across updates
+int storage_save_ota_wifi_profile(bool enabled);
+int storage_load_ota_wifi_profile(bool *enabled);
+int storage_save_ota_history(const void *history, size_t len);
+int storage_load_ota_history(void *history, size_t len);
+// Last multicast session taken, so its traffic after the reboot into the
+// new image does not erase the slot MCUboot reverts from
+int storage_save_ota_mcast_session(uint16_t session);
+int storage_load_ota_mcast_session(uint16_t *session);
+
 #endif
\ No newline at end of file
@@ -4,17 +4,42 @@
 #include <zephyr/logging/log.h>
 #include <zephyr/fs/fs.h>
 #include <zephyr/sys/reboot.h>
+#include <zephyr/dfu/mcuboot.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "web_server.h"
 #include "wifi_manager.h"
 #include "ota_manager.h"
+#include "boot_timing.h"
 
 LOG_MODULE_REGISTER(web_server);
 
 #define HTTP_PORT 80
 
+// Connections accepted at once; with h2c a single connection can also carry
+// several concurrent streams (CONFIG_HTTP_SERVER_MAX_STREAMS)
+#define HTTP_MAX_CLIENTS CONFIG_HTTP_SERVER_MAX_CLIENTS
+#define HTTP_BACKLOG 10
+
+// Flash read size per response chunk when serving the running image
+#define PEER_IMAGE_CHUNK_SIZE 1024
+
+// Longest the OTA writer may go without programming anything before an
+// upload is given up. A stalled upload resumes once half the buffer (two
+// sectors) is free, which takes several sector writes and possibly the
+// erase of a rejected sector; the wait continues for as long as those make
+// progress, so this only has to cover the slowest single flash operation.
+#define UPLOAD_WRITABLE_TIMEOUT K_SECONDS(2)
+
+// UI assets live on the LittleFS partition mounted at ASSET_FS_ROOT and are
+// served under /ui/, so the UI can change without a firmware update
+#define ASSET_FS_ROOT "/lfs"
+#define ASSET_DIR ASSET_FS_ROOT "/ui"
+#define ASSET_CHUNK_SIZE 1024
+#define ASSET_NAME_MAX 32
+
 // Simple HTML content
 static const char index_html[] = 
 "<!DOCTYPE html>\n"
@@ -71,15 +96,54 @@ static int index_handler(struct http_client_ctx *client, enum http_data_status s
                         const struct http_request_ctx *request_ctx,
                         struct http_response_ctx *response_ctx, void *user_data)
 {
+    static struct fs_file_t file;
+    static bool from_fs = false;
+    static uint8_t chunk[ASSET_CHUNK_SIZE];
+    
+    if (status == HTTP_SERVER_DATA_ABORTED) {
+        if (from_fs) {
+            fs_close(&file);
+            from_fs = false;
+        }
+        return 0;
+    }
+    
     if (status == HTTP_SERVER_DATA_FINAL) {
-        response_ctx->status = 200;
-        response_ctx->headers = (struct http_header[]){
-            {"Content-Type", "text/html"}
-        };
-        response_ctx->header_count = 1;
-        response_ctx->body = index_html;
-        response_ctx->body_len = strlen(index_html);
-        response_ctx->final_chunk = true;
+        // The callback is invoked again for every chunk until final_chunk is set
+        if (!from_fs) {
+            boot_timing_mark(BOOT_PHASE_FIRST_RESPONSE);
+            response_ctx->status = 200;
+            response_ctx->headers = (struct http_header[]){
+                {"Content-Type", "text/html"}
+            };
+            response_ctx->header_count = 1;
+            
+            fs_file_t_init(&file);
+            if (fs_open(&file, ASSET_DIR "/index.html", FS_O_READ) != 0) {
+                // No uploaded UI, fall back to the built-in page
+                response_ctx->body = index_html;
+                response_ctx->body_len = strlen(index_html);
+                response_ctx->final_chunk = true;
+                return 0;
+            }
+            from_fs = true;
+        }
+        
+        ssize_t len = fs_read(&file, chunk, sizeof(chunk));
+        if (len < 0) {
+            fs_close(&file);
+            from_fs = false;
+            return len;
+        }
+        
+        response_ctx->body = chunk;
+        response_ctx->body_len = len;
+        response_ctx->final_chunk = len < sizeof(chunk);
+        
+        if (response_ctx->final_chunk) {
+            fs_close(&file);
+            from_fs = false;
+        }
     }
     return 0;
 }
@@ -90,19 +154,25 @@ static int api_system_info_handler(struct http_client_ctx *client, enum http_dat
                                    struct http_response_ctx *response_ctx, void *user_data)
 {
     if (status == HTTP_SERVER_DATA_FINAL) {
-        static char response_buf[512];
+        static char response_buf[768];
+        char boot_buf[256];
         uint32_t uptime = k_uptime_get() / 1000;
         
+        boot_timing_mark(BOOT_PHASE_FIRST_RESPONSE);
+        boot_timing_get_json(boot_buf, sizeof(boot_buf));
+        
         snprintf(response_buf, sizeof(response_buf),
                  "{"
                  "\"version\":\"1.0.0\","
                  "\"build_date\":\"%s %s\","
                  "\"free_memory\":%zu,"
-                 "\"uptime\":%u"
+                 "\"uptime\":%u,"
+                 "\"boot_ms\":%s"
                  "}",
                  __DATE__, __TIME__,
                  k_mem_free_get(),
-                 uptime);
+                 uptime,
+                 boot_buf);
         
         response_ctx->status = 200;
         response_ctx->headers = (struct http_header[]){
@@ -148,6 +218,7 @@ static int api_wifi_status_handler(struct http_client_ctx *client, enum http_dat
     if (status == HTTP_SERVER_DATA_FINAL) {
         static char response_buf[256];
         
+        boot_timing_mark(BOOT_PHASE_FIRST_RESPONSE);
         wifi_manager_get_status(response_buf, sizeof(response_buf));
         
         response_ctx->status = 200;
@@ -267,6 +338,628 @@ static int api_wifi_scan_handler(struct http_client_ctx *client, enum http_data_
     return 0;
 }
 
+// Identifies the request a callback belongs to; HTTP/2 streams share a client
+static const void *request_owner(struct http_client_ctx *client)
+{
+    if (client->current_stream) {
+        return client->current_stream;
+    }
+    
+    return client;
+}
+
+// ota_manager token of the update the last HTTP upload started; the sector
+// and finish requests that follow it act on that update only
+static uint32_t http_ota_owner;
+
+// Builds the JSON reply for the end of an OTA transfer
+static int ota_result_response(int result, char *buf, size_t buf_len)
+{
+    if (result == 0) {
+        snprintf(buf, buf_len,
+                 "{\"success\":true,\"message\":\"Update ready, reboot to apply\"}");
+        return 200;
+    }
+    
+    if (result == -EAGAIN) {
+        // Sectors failed readback; the status lists which ones to re-send
+        ota_manager_get_status(buf, buf_len);
+        return 409;
+    }
+    
+    snprintf(buf, buf_len, "{\"success\":false,\"error\":%d}", result);
+    return 500;
+}
+
+// Handler for OTA firmware upload API
+static int api_ota_upload_handler(struct http_client_ctx *client, enum http_data_status status,
+                                  const struct http_request_ctx *request_ctx,
+                                  struct http_response_ctx *response_ctx, void *user_data)
+{
+    static const void *upload_owner = NULL;
+    static int upload_result = 0;
+    const void *owner = request_owner(client);
+    
+    // Another stream is already uploading; reject this one without
+    // disturbing the transfer in progress
+    if (upload_owner && upload_owner != owner) {
+        if (status == HTTP_SERVER_DATA_FINAL) {
+            static const char busy[] = "{\"success\":false,\"message\":\"Upload in progress\"}";
+            
+            response_ctx->status = 409;
+            response_ctx->headers = (struct http_header[]){
+                {"Content-Type", "application/json"}
+            };
+            response_ctx->header_count = 1;
+            response_ctx->body = busy;
+            response_ctx->body_len = strlen(busy);
+            response_ctx->final_chunk = true;
+        }
+        return 0;
+    }
+    
+    if (status == HTTP_SERVER_DATA_ABORTED) {
+        if (upload_owner && upload_result == 0) {
+            ota_manager_abort_update(http_ota_owner);
+        }
+        upload_owner = NULL;
+        return 0;
+    }
+    
+    if (!upload_owner) {
+        upload_result = ota_manager_start_update(&http_ota_owner);
+        upload_owner = owner;
+    }
+    
+    if (upload_result == 0 && request_ctx->data_len > 0) {
+        // Below the writer's free level, wait on it rather than inside a
+        // flash write. The server reads no further socket data meanwhile,
+        // so the TCP window closes and the sender is held to the rate
+        // flash can sustain
+        if (ota_manager_get_free_space() < request_ctx->data_len) {
+            upload_result = ota_manager_wait_writable(request_ctx->data_len,
+                                                      UPLOAD_WRITABLE_TIMEOUT);
+        }
+        if (upload_result == 0) {
+            upload_result = ota_manager_write_data(http_ota_owner, request_ctx->data,
+                                                   request_ctx->data_len);
+        }
+        if (upload_result) {
+            ota_manager_abort_update(http_ota_owner);
+        }
+    }
+    
+    if (status == HTTP_SERVER_DATA_FINAL) {
+        static char response_buf[512];
+        
+        if (upload_result == 0) {
+            upload_result = ota_manager_finish_update(http_ota_owner);
+        }
+        
+        response_ctx->status = ota_result_response(upload_result, response_buf,
+                                                   sizeof(response_buf));
+        response_ctx->headers = (struct http_header[]){
+            {"Content-Type", "application/json"}
+        };
+        response_ctx->header_count = 1;
+        response_ctx->body = response_buf;
+        response_ctx->body_len = strlen(response_buf);
+        response_ctx->final_chunk = true;
+        
+        upload_owner = NULL; // Reset for next request
+    }
+    
+    return 0;
+}
+
+// Handler for re-sending a single sector that failed readback verification
+static int api_ota_sector_handler(struct http_client_ctx *client, enum http_data_status status,
+                                  const struct http_request_ctx *request_ctx,
+                                  struct http_response_ctx *response_ctx, void *user_data)
+{
+    static size_t total_received = 0;
+    static int sector_result = 0;
+    
+    if (status == HTTP_SERVER_DATA_ABORTED) {
+        total_received = 0;
+        sector_result = 0;
+        return 0;
+    }
+    
+    // URL is /api/ota/sector/<index>
+    const char *index_str = strrchr((const char *)client->url_buffer, '/') + 1;
+    char *end;
+    unsigned long sector = strtoul(index_str, &end, 10);
+    
+    if (end == index_str || *end != '\0' || sector >= ota_manager_sector_count()) {
+        sector_result = -EINVAL;
+    }
+    
+    size_t offset = sector * OTA_MANAGER_SECTOR_SIZE;
+    
+    if (sector_result == 0 && request_ctx->data_len > 0) {
+        sector_result = ota_manager_repair_data(http_ota_owner, offset + total_received,
+                                                request_ctx->data,
+                                                request_ctx->data_len);
+        total_received += request_ctx->data_len;
+    }
+    
+    if (status == HTTP_SERVER_DATA_FINAL) {
+        static char response_buf[128];
+        
+        if (sector_result == 0) {
+            snprintf(response_buf, sizeof(response_buf),
+                     "{\"success\":true,\"bytes\":%zu}", total_received);
+            response_ctx->status = 200;
+        } else {
+            snprintf(response_buf, sizeof(response_buf),
+                     "{\"success\":false,\"error\":%d}", sector_result);
+            response_ctx->status = 400;
+        }
+        
+        response_ctx->headers = (struct http_header[]){
+            {"Content-Type", "application/json"}
+        };
+        response_ctx->header_count = 1;
+        response_ctx->body = response_buf;
+        response_ctx->body_len = strlen(response_buf);
+        response_ctx->final_chunk = true;
+        
+        total_received = 0; // Reset for next request
+        sector_result = 0;
+    }
+    
+    return 0;
+}
+
+// Handler for completing an update after re-sent sectors
+static int api_ota_finish_handler(struct http_client_ctx *client, enum http_data_status status,
+                                  const struct http_request_ctx *request_ctx,
+                                  struct http_response_ctx *response_ctx, void *user_data)
+{
+    if (status == HTTP_SERVER_DATA_FINAL) {
+        static char response_buf[512];
+        int ret = ota_manager_finish_update(http_ota_owner);
+        
+        response_ctx->status = ota_result_response(ret, response_buf, sizeof(response_buf));
+        response_ctx->headers = (struct http_header[]){
+            {"Content-Type", "application/json"}
+        };
+        response_ctx->header_count = 1;
+        response_ctx->body = response_buf;
+        response_ctx->body_len = strlen(response_buf);
+        response_ctx->final_chunk = true;
+    }
+    return 0;
+}
+
+// Handler for giving up an update, e.g. one left open after a failed readback
+static int api_ota_abort_handler(struct http_client_ctx *client, enum http_data_status status,
+                                 const struct http_request_ctx *request_ctx,
+                                 struct http_response_ctx *response_ctx, void *user_data)
+{
+    if (status == HTTP_SERVER_DATA_FINAL) {
+        static char response_buf[128];
+        // Whoever started it; this is how a stuck update is cleared
+        int ret = ota_manager_abort_update(OTA_MANAGER_OWNER_ANY);
+        
+        if (ret == 0) {
+            snprintf(response_buf, sizeof(response_buf), "{\"success\":true}");
+            response_ctx->status = 200;
+        } else {
+            snprintf(response_buf, sizeof(response_buf),
+                     "{\"success\":false,\"message\":\"No update in progress\"}");
+            response_ctx->status = 409;
+        }
+        
+        response_ctx->headers = (struct http_header[]){
+            {"Content-Type", "application/json"}
+        };
+        response_ctx->header_count = 1;
+        response_ctx->body = response_buf;
+        response_ctx->body_len = strlen(response_buf);
+        response_ctx->final_chunk = true;
+    }
+    return 0;
+}
+
+// Handler for OTA status API
+static int api_ota_status_handler(struct http_client_ctx *client, enum http_data_status status,
+                                  const struct http_request_ctx *request_ctx,
+                                  struct http_response_ctx *response_ctx, void *user_data)
+{
+    if (status == HTTP_SERVER_DATA_FINAL) {
+        static char response_buf[512];
+        
+        boot_timing_mark(BOOT_PHASE_FIRST_RESPONSE);
+        ota_manager_get_status(response_buf, sizeof(response_buf));
+        
+        response_ctx->status = 200;
+        response_ctx->headers = (struct http_header[]){
+            {"Content-Type", "application/json"}
+        };
+        response_ctx->header_count = 1;
+        response_ctx->body = response_buf;
+        response_ctx->body_len = strlen(response_buf);
+        response_ctx->final_chunk = true;
+    }
+    return 0;
+}
+
+#if defined(CONFIG_APP_OTA_WIFI_PROFILE)
+// Handler for switching the WiFi throughput profile used during transfers
+static int api_ota_wifi_profile_handler(struct http_client_ctx *client,
+                                        enum http_data_status status,
+                                        const struct http_request_ctx *request_ctx,
+                                        struct http_response_ctx *response_ctx,
+                                        void *user_data)
+{
+    static char request_buffer[64];
+    static size_t total_received = 0;
+    
+    if (status == HTTP_SERVER_DATA_ABORTED) {
+        total_received = 0;
+        return 0;
+    }
+    
+    if (total_received + request_ctx->data_len < sizeof(request_buffer)) {
+        memcpy(request_buffer + total_received, request_ctx->data, request_ctx->data_len);
+        total_received += request_ctx->data_len;
+    }
+    
+    if (status == HTTP_SERVER_DATA_FINAL) {
+        static char response_buf[128];
+        int ret = -EINVAL;
+        
+        request_buffer[total_received] = '\0';
+        
+        // Accepts {"enabled":true} or {"enabled":false}; GET only reports
+        if (client->method == HTTP_GET) {
+            ret = 0;
+        } else if (strstr(request_buffer, "\"enabled\":true")) {
+            ret = ota_manager_set_wifi_profile(true);
+        } else if (strstr(request_buffer, "\"enabled\":false")) {
+            ret = ota_manager_set_wifi_profile(false);
+        }
+        
+        if (ret == 0) {
+            snprintf(response_buf, sizeof(response_buf),
+                     "{\"success\":true,\"enabled\":%s}",
+                     ota_manager_get_wifi_profile() ? "true" : "false");
+        } else {
+            snprintf(response_buf, sizeof(response_buf),
+                     "{\"success\":false,\"error\":%d}", ret);
+        }
+        
+        response_ctx->status = ret == 0 ? 200 : (ret == -EINVAL ? 400 : 500);
+        response_ctx->headers = (struct http_header[]){
+            {"Content-Type", "application/json"}
+        };
+        response_ctx->header_count = 1;
+        response_ctx->body = response_buf;
+        response_ctx->body_len = strlen(response_buf);
+        response_ctx->final_chunk = true;
+        
+        total_received = 0; // Reset for next request
+    }
+    
+    return 0;
+}
+#endif
+
+// Handler for pulling an update from a URL or from an already-updated peer
+static int api_ota_pull_handler(struct http_client_ctx *client, enum http_data_status status,
+                                const struct http_request_ctx *request_ctx,
+                                struct http_response_ctx *response_ctx, void *user_data)
+{
+    static char request_buffer[256];
+    static size_t total_received = 0;
+    
+    if (status == HTTP_SERVER_DATA_ABORTED) {
+        total_received = 0;
+        return 0;
+    }
+    
+    if (total_received + request_ctx->data_len < sizeof(request_buffer)) {
+        memcpy(request_buffer + total_received, request_ctx->data, request_ctx->data_len);
+        total_received += request_ctx->data_len;
+    }
+    
+    if (status == HTTP_SERVER_DATA_FINAL) {
+        static char response_buf[128];
+        char url[128] = {0};
+        int ret = -EINVAL;
+        
+        request_buffer[total_received] = '\0';
+        
+        // Accepts {"url":"http://..."} or {"peer":"<address>"}
+        char *url_start = strstr(request_buffer, "\"url\":\"");
+        char *peer_start = strstr(request_buffer, "\"peer\":\"");
+        
+        if (url_start) {
+            url_start += 7; // Move past "url":"
+            char *url_end = strchr(url_start, '"');
+            if (url_end && (url_end - url_start) < sizeof(url) - 1) {
+                strncpy(url, url_start, url_end - url_start);
+            }
+        } else if (peer_start) {
+            peer_start += 8; // Move past "peer":"
+            char *peer_end = strchr(peer_start, '"');
+            if (peer_end && (peer_end - peer_start) < 64) {
+                snprintf(url, sizeof(url), "http://%.*s%s", (int)(peer_end - peer_start),
+                         peer_start, OTA_MANAGER_PEER_IMAGE_PATH);
+            }
+        }
+        
+        if (url[0]) {
+            ret = ota_manager_update_from_url_async(url);
+        }
+        
+        if (ret == 0) {
+            snprintf(response_buf, sizeof(response_buf),
+                     "{\"success\":true,\"message\":\"Download started\"}");
+        } else {
+            snprintf(response_buf, sizeof(response_buf),
+                     "{\"success\":false,\"error\":%d}", ret);
+        }
+        
+        response_ctx->status = ret == 0 ? 202 : 400;
+        response_ctx->headers = (struct http_header[]){
+            {"Content-Type", "application/json"}
+        };
+        response_ctx->header_count = 1;
+        response_ctx->body = response_buf;
+        response_ctx->body_len = strlen(response_buf);
+        response_ctx->final_chunk = true;
+        
+        total_received = 0; // Reset for next request
+    }
+    
+    return 0;
+}
+
+#if defined(CONFIG_APP_OTA_PEER_SERVE)
+HTTP_SERVER_REGISTER_HEADER_CAPTURE(range_header, "Range");
+
+// Parses "bytes=first-last", "bytes=first-" and "bytes=-suffix"
+static int parse_range(const char *value, size_t total, size_t *first, size_t *last)
+{
+    char *end;
+    
+    if (strncmp(value, "bytes=", 6) != 0) {
+        return -EINVAL;
+    }
+    value += 6;
+    
+    if (*value == '-') {
+        size_t suffix = strtoul(value + 1, &end, 10);
+        if (suffix == 0) {
+            return -EINVAL;
+        }
+        *first = suffix < total ? total - suffix : 0;
+        *last = total - 1;
+        return 0;
+    }
+    
+    *first = strtoul(value, &end, 10);
+    if (end == value || *end != '-') {
+        return -EINVAL;
+    }
+    
+    *last = total - 1;
+    if (end[1] != '\0') {
+        *last = MIN(strtoul(end + 1, NULL, 10), total - 1);
+    }
+    
+    return *first <= *last ? 0 : -EINVAL;
+}
+
+// Handler serving the running (slot0) image to peers, straight from flash
+static int api_ota_image_handler(struct http_client_ctx *client, enum http_data_status status,
+                                 const struct http_request_ctx *request_ctx,
+                                 struct http_response_ctx *response_ctx, void *user_data)
+{
+    static uint8_t chunk[PEER_IMAGE_CHUNK_SIZE];
+    static char content_range[48];
+    static struct http_header image_headers[] = {
+        {"Content-Type", "application/octet-stream"},
+        {"Accept-Ranges", "bytes"},
+        {"Content-Range", content_range},
+    };
+    static bool streaming = false;
+    static size_t pos, last;
+    
+    if (status == HTTP_SERVER_DATA_ABORTED) {
+        streaming = false;
+        return 0;
+    }
+    
+    if (status != HTTP_SERVER_DATA_FINAL) {
+        return 0;
+    }
+    
+    // The callback is invoked again for every chunk until final_chunk is set
+    if (!streaming) {
+        size_t total;
+        
+        // Only a confirmed image is worth spreading
+        if (!boot_is_img_confirmed() || ota_manager_get_running_image_size(&total)) {
+            response_ctx->status = 503;
+            response_ctx->final_chunk = true;
+            return 0;
+        }
+        
+        pos = 0;
+        last = total - 1;
+        response_ctx->status = 200;
+        response_ctx->headers = image_headers;
+        response_ctx->header_count = 2;
+        
+        for (size_t i = 0; i < request_ctx->header_count; i++) {
+            if (strcmp(request_ctx->headers[i].name, "Range") != 0) {
+                continue;
+            }
+            
+            if (parse_range(request_ctx->headers[i].value, total, &pos, &last)) {
+                snprintf(content_range, sizeof(content_range), "bytes */%zu", total);
+                response_ctx->status = 416;
+                response_ctx->header_count = 3;
+                response_ctx->final_chunk = true;
+                return 0;
+            }
+            
+            snprintf(content_range, sizeof(content_range), "bytes %zu-%zu/%zu",
+                     pos, last, total);
+            response_ctx->status = 206;
+            response_ctx->header_count = 3;
+        }
+        
+        streaming = true;
+    }
+    
+    size_t len = MIN(sizeof(chunk), last - pos + 1);
+    
+    int ret = ota_manager_read_running_image(pos, chunk, len);
+    if (ret) {
+        LOG_ERR("Failed to read image at %zu: %d", pos, ret);
+        streaming = false;
+        return ret;
+    }
+    
+    pos += len;
+    
+    response_ctx->body = chunk;
+    response_ctx->body_len = len;
+    response_ctx->final_chunk = pos > last;
+    
+    if (response_ctx->final_chunk) {
+        streaming = false;
+    }
+    
+    return 0;
+}
+#endif
+
+// Handler for uploading one UI asset to the filesystem
+static int api_assets_upload_handler(struct http_client_ctx *client, enum http_data_status status,
+                                     const struct http_request_ctx *request_ctx,
+                                     struct http_response_ctx *response_ctx, void *user_data)
+{
+    static const void *upload_owner = NULL;
+    static struct fs_file_t file;
+    static char name[ASSET_NAME_MAX + 2];
+    static char tmp_path[sizeof(ASSET_DIR) + ASSET_NAME_MAX + 8];
+    static bool file_open = false;
+    static size_t total_received = 0;
+    static int upload_result = 0;
+    const void *owner = request_owner(client);
+    
+    // One asset at a time: the file and counters above belong to the
+    // stream that started first
+    if (upload_owner && upload_owner != owner) {
+        if (status == HTTP_SERVER_DATA_FINAL) {
+            static const char busy[] = "{\"success\":false,\"message\":\"Upload in progress\"}";
+            
+            response_ctx->status = 409;
+            response_ctx->headers = (struct http_header[]){
+                {"Content-Type", "application/json"}
+            };
+            response_ctx->header_count = 1;
+            response_ctx->body = busy;
+            response_ctx->body_len = strlen(busy);
+            response_ctx->final_chunk = true;
+        }
+        return 0;
+    }
+    
+    if (status == HTTP_SERVER_DATA_ABORTED) {
+        if (file_open) {
+            fs_close(&file);
+            fs_unlink(tmp_path);
+            file_open = false;
+        }
+        upload_owner = NULL;
+        total_received = 0;
+        upload_result = 0;
+        return 0;
+    }
+    
+    if (!upload_owner) {
+        // URL is /api/assets/<name>, possibly followed by a query string.
+        // Taken once, as the URL buffer is shared by the client's streams.
+        const char *url_name = strrchr((const char *)client->url_buffer, '/') + 1;
+        size_t name_len = strcspn(url_name, "?");
+        
+        snprintf(name, sizeof(name), "%.*s", (int)MIN(name_len, ASSET_NAME_MAX + 1),
+                 url_name);
+        upload_owner = owner;
+    }
+    
+    // Written to a temporary file so a failed upload keeps the old asset
+    if (!file_open && upload_result == 0) {
+        if (name[0] == '\0' || name[0] == '.' || strlen(name) > ASSET_NAME_MAX) {
+            upload_result = -EINVAL;
+        } else {
+            fs_mkdir(ASSET_DIR);
+            snprintf(tmp_path, sizeof(tmp_path), "%s/%s.tmp", ASSET_DIR, name);
+            fs_file_t_init(&file);
+            upload_result = fs_open(&file, tmp_path, FS_O_CREATE | FS_O_WRITE | FS_O_TRUNC);
+            file_open = upload_result == 0;
+        }
+    }
+    
+    if (file_open && request_ctx->data_len > 0) {
+        ssize_t written = fs_write(&file, request_ctx->data, request_ctx->data_len);
+        if (written != request_ctx->data_len) {
+            upload_result = written < 0 ? written : -ENOSPC;
+        }
+        total_received += request_ctx->data_len;
+    }
+    
+    if (status == HTTP_SERVER_DATA_FINAL) {
+        static char response_buf[128];
+        char path[sizeof(ASSET_DIR) + ASSET_NAME_MAX + 2];
+        
+        if (file_open) {
+            fs_close(&file);
+            file_open = false;
+            
+            if (upload_result == 0) {
+                // LittleFS replaces an existing target atomically
+                snprintf(path, sizeof(path), "%s/%s", ASSET_DIR, name);
+                upload_result = fs_rename(tmp_path, path);
+            } else {
+                fs_unlink(tmp_path);
+            }
+        }
+        
+        if (upload_result == 0) {
+            LOG_INF("Asset %s updated, %zu bytes", name, total_received);
+            snprintf(response_buf, sizeof(response_buf),
+                     "{\"success\":true,\"bytes\":%zu}", total_received);
+            response_ctx->status = 200;
+        } else {
+            snprintf(response_buf, sizeof(response_buf),
+                     "{\"success\":false,\"error\":%d}", upload_result);
+            response_ctx->status = upload_result == -EINVAL ? 400 : 500;
+        }
+        
+        response_ctx->headers = (struct http_header[]){
+            {"Content-Type", "application/json"}
+        };
+        response_ctx->header_count = 1;
+        response_ctx->body = response_buf;
+        response_ctx->body_len = strlen(response_buf);
+        response_ctx->final_chunk = true;
+        
+        upload_owner = NULL; // Reset for next request
+        total_received = 0;
+        upload_result = 0;
+    }
+    
+    return 0;
+}
+
 // Resource definitions
 static struct http_resource_detail_dynamic index_resource_detail = {
     .common = {
@@ -322,6 +1015,100 @@ static struct http_resource_detail_dynamic api_wifi_scan_resource_detail = {
     .user_data = NULL,
 };
 
+static struct http_resource_detail_dynamic api_ota_upload_resource_detail = {
+    .common = {
+        .type = HTTP_RESOURCE_TYPE_DYNAMIC,
+        .bitmask_of_supported_http_methods = BIT(HTTP_POST),
+    },
+    .cb = api_ota_upload_handler,
+    .user_data = NULL,
+};
+
+static struct http_resource_detail_dynamic api_ota_sector_resource_detail = {
+    .common = {
+        .type = HTTP_RESOURCE_TYPE_DYNAMIC,
+        .bitmask_of_supported_http_methods = BIT(HTTP_POST),
+    },
+    .cb = api_ota_sector_handler,
+    .user_data = NULL,
+};
+
+static struct http_resource_detail_dynamic api_ota_finish_resource_detail = {
+    .common = {
+        .type = HTTP_RESOURCE_TYPE_DYNAMIC,
+        .bitmask_of_supported_http_methods = BIT(HTTP_POST),
+    },
+    .cb = api_ota_finish_handler,
+    .user_data = NULL,
+};
+
+static struct http_resource_detail_dynamic api_ota_abort_resource_detail = {
+    .common = {
+        .type = HTTP_RESOURCE_TYPE_DYNAMIC,
+        .bitmask_of_supported_http_methods = BIT(HTTP_POST),
+    },
+    .cb = api_ota_abort_handler,
+    .user_data = NULL,
+};
+
+static struct http_resource_detail_dynamic api_ota_status_resource_detail = {
+    .common = {
+        .type = HTTP_RESOURCE_TYPE_DYNAMIC,
+        .bitmask_of_supported_http_methods = BIT(HTTP_GET),
+    },
+    .cb = api_ota_status_handler,
+    .user_data = NULL,
+};
+
+#if defined(CONFIG_APP_OTA_WIFI_PROFILE)
+static struct http_resource_detail_dynamic api_ota_wifi_profile_resource_detail = {
+    .common = {
+        .type = HTTP_RESOURCE_TYPE_DYNAMIC,
+        .bitmask_of_supported_http_methods = BIT(HTTP_GET) | BIT(HTTP_POST),
+    },
+    .cb = api_ota_wifi_profile_handler,
+    .user_data = NULL,
+};
+#endif
+
+static struct http_resource_detail_dynamic api_ota_pull_resource_detail = {
+    .common = {
+        .type = HTTP_RESOURCE_TYPE_DYNAMIC,
+        .bitmask_of_supported_http_methods = BIT(HTTP_POST),
+    },
+    .cb = api_ota_pull_handler,
+    .user_data = NULL,
+};
+
+#if defined(CONFIG_APP_OTA_PEER_SERVE)
+static struct http_resource_detail_dynamic api_ota_image_resource_detail = {
+    .common = {
+        .type = HTTP_RESOURCE_TYPE_DYNAMIC,
+        .bitmask_of_supported_http_methods = BIT(HTTP_GET),
+    },
+    .cb = api_ota_image_handler,
+    .user_data = NULL,
+};
+#endif
+
+static struct http_resource_detail_dynamic api_assets_upload_resource_detail = {
+    .common = {
+        .type = HTTP_RESOURCE_TYPE_DYNAMIC,
+        .bitmask_of_supported_http_methods = BIT(HTTP_POST) | BIT(HTTP_PUT),
+    },
+    .cb = api_assets_upload_handler,
+    .user_data = NULL,
+};
+
+// Streams /ui/<file> from ASSET_FS_ROOT in CONFIG_HTTP_SERVER_STATIC_FS_RESPONSE_SIZE chunks
+static struct http_resource_detail_static_fs ui_resource_detail = {
+    .common = {
+        .type = HTTP_RESOURCE_TYPE_STATIC_FS,
+        .bitmask_of_supported_http_methods = BIT(HTTP_GET),
+    },
+    .fs_path = ASSET_FS_ROOT,
+};
+
 // HTTP resources - defined in a special section
 HTTP_RESOURCE_DEFINE(index_resource, my_service, "/", &index_resource_detail);
 HTTP_RESOURCE_DEFINE(api_system_info_resource, my_service, "/api/system/info", &api_system_info_resource_detail);
@@ -329,15 +1116,34 @@ HTTP_RESOURCE_DEFINE(api_system_reboot_resource, my_service, "/api/system/reboot
 HTTP_RESOURCE_DEFINE(api_wifi_status_resource, my_service, "/api/wifi/status", &api_wifi_status_resource_detail);
 HTTP_RESOURCE_DEFINE(api_wifi_connect_resource, my_service, "/api/wifi/connect", &api_wifi_connect_resource_detail);
 HTTP_RESOURCE_DEFINE(api_wifi_scan_resource, my_service, "/api/wifi/scan", &api_wifi_scan_resource_detail);
+HTTP_RESOURCE_DEFINE(api_ota_upload_resource, my_service, "/api/ota/upload", &api_ota_upload_resource_detail);
+HTTP_RESOURCE_DEFINE(api_ota_sector_resource, my_service, "/api/ota/sector/*", &api_ota_sector_resource_detail);
+HTTP_RESOURCE_DEFINE(api_ota_finish_resource, my_service, "/api/ota/finish", &api_ota_finish_resource_detail);
+HTTP_RESOURCE_DEFINE(api_ota_abort_resource, my_service, "/api/ota/abort", &api_ota_abort_resource_detail);
+HTTP_RESOURCE_DEFINE(api_ota_status_resource, my_service, "/api/ota/status", &api_ota_status_resource_detail);
+HTTP_RESOURCE_DEFINE(api_ota_pull_resource, my_service, "/api/ota/pull", &api_ota_pull_resource_detail);
+HTTP_RESOURCE_DEFINE(api_assets_upload_resource, my_service, "/api/assets/*", &api_assets_upload_resource_detail);
+HTTP_RESOURCE_DEFINE(ui_resource, my_service, "/ui/*", &ui_resource_detail);
+#if defined(CONFIG_APP_OTA_WIFI_PROFILE)
+HTTP_RESOURCE_DEFINE(api_ota_wifi_profile_resource, my_service, "/api/ota/wifi_profile", &api_ota_wifi_profile_resource_detail);
+#endif
+#if defined(CONFIG_APP_OTA_PEER_SERVE)
+HTTP_RESOURCE_DEFINE(api_ota_image_resource, my_service, OTA_MANAGER_PEER_IMAGE_PATH, &api_ota_image_resource_detail);
+#endif
 
 // HTTP service
 static uint16_t http_service_port = HTTP_PORT;
-HTTP_SERVICE_DEFINE(my_service, "0.0.0.0", &http_service_port, 1, 10, NULL);
+HTTP_SERVICE_DEFINE(my_service, "0.0.0.0", &http_service_port, HTTP_MAX_CLIENTS, HTTP_BACKLOG, NULL);
 
 int web_server_start(void)
 {
-    // In Zephyr 4.2.0, HTTP services start automatically when defined
-    // No explicit start function is needed
+    // Services are defined statically but only listen once started
+    int ret = http_server_start();
+    if (ret && ret != -EALREADY) {
+        LOG_ERR("Failed to start HTTP server: %d", ret);
+        return ret;
+    }
+    
     LOG_INF("HTTP server configured on port %d", HTTP_PORT);
     return 0;
 }
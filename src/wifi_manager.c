@@ -13,6 +13,10 @@ static struct net_if *wifi_iface;
 static bool connected = false;
 static bool ap_mode = false;
 
+// Power-save settings to put back when the OTA profile is left
+static struct wifi_ps_params saved_ps;
+static bool ota_profile = false;
+
 int wifi_manager_init(void)
 {
     wifi_iface = net_if_get_default();
@@ -135,6 +139,83 @@ int wifi_manager_stop_ap(void)
     return net_mgmt(NET_REQUEST_WIFI_AP_DISABLE, wifi_iface, NULL, 0);
 }
 
+static int wifi_manager_set_ps(enum wifi_ps_param_type type, enum wifi_ps enabled,
+                               unsigned short listen_interval)
+{
+    struct wifi_ps_params params = {0};
+    
+    params.type = type;
+    params.enabled = enabled;
+    params.listen_interval = listen_interval;
+    
+    int ret = net_mgmt(NET_REQUEST_WIFI_PS, wifi_iface, &params, sizeof(params));
+    if (ret) {
+        LOG_DBG("Power save parameter %d not applied: %d (reason %d)",
+                type, ret, params.fail_reason);
+    }
+    
+    return ret;
+}
+
+int wifi_manager_ota_profile_enter(void)
+{
+    struct wifi_ps_config config = {0};
+    
+    if (!wifi_iface || ap_mode) {
+        return -ENODEV;
+    }
+    
+    if (ota_profile) {
+        return 0;
+    }
+    
+    if (net_mgmt(NET_REQUEST_WIFI_PS_CONFIG, wifi_iface, &config, sizeof(config)) == 0) {
+        saved_ps = config.ps_params;
+    } else {
+        // Drivers that cannot report it start with power save on
+        memset(&saved_ps, 0, sizeof(saved_ps));
+        saved_ps.enabled = WIFI_PS_ENABLED;
+    }
+    
+    int ret = wifi_manager_set_ps(WIFI_PS_PARAM_STATE, WIFI_PS_DISABLED, 0);
+    if (ret) {
+        LOG_WRN("Cannot disable power save for OTA: %d", ret);
+        return ret;
+    }
+    
+    // Wake for every beacon should the driver keep dozing anyway;
+    // optional, many drivers only take the interval at association
+    wifi_manager_set_ps(WIFI_PS_PARAM_LISTEN_INTERVAL, WIFI_PS_DISABLED, 1);
+    
+    ota_profile = true;
+    LOG_INF("WiFi OTA profile on, power save was %s",
+            saved_ps.enabled == WIFI_PS_ENABLED ? "on" : "off");
+    return 0;
+}
+
+int wifi_manager_ota_profile_leave(void)
+{
+    if (!ota_profile) {
+        return 0;
+    }
+    
+    ota_profile = false;
+    
+    if (saved_ps.listen_interval) {
+        wifi_manager_set_ps(WIFI_PS_PARAM_LISTEN_INTERVAL, saved_ps.enabled,
+                            saved_ps.listen_interval);
+    }
+    
+    int ret = wifi_manager_set_ps(WIFI_PS_PARAM_STATE, saved_ps.enabled, 0);
+    if (ret) {
+        LOG_WRN("Failed to restore power save: %d", ret);
+        return ret;
+    }
+    
+    LOG_INF("WiFi OTA profile off");
+    return 0;
+}
+
 bool wifi_manager_is_connected(void)
 {
     return connected && !ap_mode;
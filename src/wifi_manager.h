@@ -20,6 +20,11 @@ int wifi_manager_disconnect(void);
 int wifi_manager_start_ap(void);
 int wifi_manager_stop_ap(void);
 bool wifi_manager_is_connected(void);
+
+// Keep the radio awake for the length of an OTA transfer; leave restores
+// the power-save settings that were active on enter
+int wifi_manager_ota_profile_enter(void);
+int wifi_manager_ota_profile_leave(void);
 int wifi_manager_get_status(char *buf, size_t buf_len);
 
 #endif
\ No newline at end of file
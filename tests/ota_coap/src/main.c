@@ -0,0 +1,204 @@
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+#include <zephyr/net/coap.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/dfu/mcuboot.h>
+#include <zephyr/random/random.h>
+#include <string.h>
+
+#include "ota_manager.h"
+
+// Drives the CoAP "fw" resource over loopback the way a constrained client
+// would and checks what ota_manager programmed into slot1 on the flash
+// simulator
+
+#define TEST_BLOCK_SIZE CONFIG_APP_OTA_COAP_BLOCK_SIZE
+#define TEST_IMAGE_SIZE (2 * OTA_MANAGER_SECTOR_SIZE + 1800)
+#define TEST_BLOCKS DIV_ROUND_UP(TEST_IMAGE_SIZE, TEST_BLOCK_SIZE)
+#define TEST_REPLY_TIMEOUT_MS 20000
+
+static uint8_t image[TEST_IMAGE_SIZE];
+static uint8_t readback[TEST_IMAGE_SIZE];
+static uint8_t msg[TEST_BLOCK_SIZE * 2 + 64];
+static int sock = -1;
+static int upgrades_requested;
+
+// Stands in for MCUboot, which is not part of this build
+int boot_request_upgrade(int permanent)
+{
+    ARG_UNUSED(permanent);
+    
+    upgrades_requested++;
+    return 0;
+}
+
+struct reply {
+    uint8_t code;
+    int block1;  // -1 without a Block1 option
+};
+
+static void put_block(uint32_t num, bool more, uint16_t size, const uint8_t *payload,
+                      size_t len, struct reply *reply)
+{
+    static const char *const fw_path[] = { "fw", NULL };
+    struct sockaddr_in server = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_APP_OTA_COAP_PORT),
+    };
+    struct coap_packet packet;
+    uint8_t token[4];
+    
+    sys_rand_get(token, sizeof(token));
+    zsock_inet_pton(AF_INET, "127.0.0.1", &server.sin_addr);
+    
+    zassert_ok(coap_packet_init(&packet, msg, sizeof(msg), COAP_VERSION_1, COAP_TYPE_CON,
+                                sizeof(token), token, COAP_METHOD_PUT, coap_next_id()));
+    zassert_ok(coap_packet_set_path(&packet, fw_path[0]));
+    zassert_ok(coap_append_option_int(&packet, COAP_OPTION_BLOCK1,
+                                      (num << 4) | (more ? BIT(3) : 0) |
+                                      coap_bytes_to_block_size(size)));
+    zassert_ok(coap_packet_append_payload_marker(&packet));
+    zassert_ok(coap_packet_append_payload(&packet, payload, len));
+    
+    zassert_equal(zsock_sendto(sock, packet.data, packet.offset, 0,
+                               (struct sockaddr *)&server, sizeof(server)),
+                  packet.offset);
+    
+    // The reply to the final block waits for readback verification
+    int received = zsock_recv(sock, msg, sizeof(msg), 0);
+    zassert_true(received > 0, "No reply to block %u", num);
+    
+    struct coap_packet response;
+    
+    zassert_ok(coap_packet_parse(&response, msg, received, NULL, 0));
+    reply->code = coap_header_get_code(&response);
+    reply->block1 = coap_get_option_int(&response, COAP_OPTION_BLOCK1);
+    if (reply->block1 < 0) {
+        reply->block1 = -1;
+    }
+}
+
+static void send_block(uint32_t num, struct reply *reply)
+{
+    size_t off = (size_t)num * TEST_BLOCK_SIZE;
+    size_t len = MIN(TEST_BLOCK_SIZE, TEST_IMAGE_SIZE - off);
+    
+    put_block(num, num != TEST_BLOCKS - 1, TEST_BLOCK_SIZE, &image[off], len, reply);
+}
+
+static void expect_block(uint32_t num, uint8_t code)
+{
+    struct reply reply;
+    
+    send_block(num, &reply);
+    zassert_equal(reply.code, code, "Block %u: code 0x%02x, expected 0x%02x",
+                  num, reply.code, code);
+}
+
+static void check_slot(void)
+{
+    zassert_equal(upgrades_requested, 1, "Upgrade requested %d times", upgrades_requested);
+    zassert_ok(ota_manager_read_data(0, readback, sizeof(readback)));
+    zassert_mem_equal(readback, image, sizeof(image));
+}
+
+ZTEST(ota_coap, test_in_order)
+{
+    for (uint32_t num = 0; num < TEST_BLOCKS - 1; num++) {
+        expect_block(num, COAP_RESPONSE_CODE_CONTINUE);
+    }
+    expect_block(TEST_BLOCKS - 1, COAP_RESPONSE_CODE_CHANGED);
+    
+    check_slot();
+}
+
+ZTEST(ota_coap, test_out_of_order)
+{
+    // Swap neighbouring blocks after the first, staying inside the window
+    // and keeping the final block last
+    expect_block(0, COAP_RESPONSE_CODE_CONTINUE);
+    
+    uint32_t num = 1;
+    
+    for (; num + 2 < TEST_BLOCKS; num += 2) {
+        expect_block(num + 1, COAP_RESPONSE_CODE_CONTINUE);
+        expect_block(num, COAP_RESPONSE_CODE_CONTINUE);
+    }
+    for (; num < TEST_BLOCKS - 1; num++) {
+        expect_block(num, COAP_RESPONSE_CODE_CONTINUE);
+    }
+    expect_block(TEST_BLOCKS - 1, COAP_RESPONSE_CODE_CHANGED);
+    
+    check_slot();
+}
+
+ZTEST(ota_coap, test_duplicates)
+{
+    // Every block twice, as if each ACK had been lost
+    for (uint32_t num = 0; num < TEST_BLOCKS - 1; num++) {
+        expect_block(num, COAP_RESPONSE_CODE_CONTINUE);
+        expect_block(num, COAP_RESPONSE_CODE_CONTINUE);
+    }
+    expect_block(TEST_BLOCKS - 1, COAP_RESPONSE_CODE_CHANGED);
+    
+    // Retransmissions after completion get the same answers again
+    // without starting another update
+    expect_block(TEST_BLOCKS - 1, COAP_RESPONSE_CODE_CHANGED);
+    expect_block(TEST_BLOCKS / 2, COAP_RESPONSE_CODE_CONTINUE);
+    
+    check_slot();
+}
+
+ZTEST(ota_coap, test_block_too_large)
+{
+    struct reply reply;
+    
+    put_block(0, true, TEST_BLOCK_SIZE * 2, image, TEST_BLOCK_SIZE * 2, &reply);
+    
+    // Refused with the size to retry with, before any update starts
+    zassert_equal(reply.code, COAP_RESPONSE_CODE_REQUEST_TOO_LARGE);
+    zassert_equal(reply.block1 & 0x7, coap_bytes_to_block_size(TEST_BLOCK_SIZE));
+    zassert_equal(upgrades_requested, 0);
+    
+    // The client retries with the preferred size
+    for (uint32_t num = 0; num < TEST_BLOCKS - 1; num++) {
+        expect_block(num, COAP_RESPONSE_CODE_CONTINUE);
+    }
+    expect_block(TEST_BLOCKS - 1, COAP_RESPONSE_CODE_CHANGED);
+    
+    check_slot();
+}
+
+static void *ota_coap_setup(void)
+{
+    struct timeval timeout = {
+        .tv_sec = TEST_REPLY_TIMEOUT_MS / 1000,
+    };
+    
+    zassert_ok(ota_manager_init());
+    
+    sock = zsock_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    zassert_true(sock >= 0);
+    zassert_ok(zsock_setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)));
+    
+    return NULL;
+}
+
+static void ota_coap_before(void *fixture)
+{
+    ARG_UNUSED(fixture);
+    
+    // A different image each time, so a stale slot cannot pass
+    sys_rand_get(image, sizeof(image));
+    memset(readback, 0, sizeof(readback));
+    upgrades_requested = 0;
+}
+
+static void ota_coap_teardown(void *fixture)
+{
+    ARG_UNUSED(fixture);
+    
+    zsock_close(sock);
+}
+
+ZTEST_SUITE(ota_coap, NULL, ota_coap_setup, ota_coap_before, NULL, ota_coap_teardown);
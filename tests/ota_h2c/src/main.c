@@ -0,0 +1,479 @@
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/net/http/service.h>
+#include <zephyr/net/http/hpack.h>
+#include <zephyr/sys/byteorder.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "ota_manager.h"
+
+// Speaks h2c with prior knowledge to the HTTP server over loopback and
+// measures how long GET /status takes on the same connection, first idle
+// and then while a firmware image is streamed to /upload as another
+// stream. This is the case scripts/status_latency.sh measures against a
+// device; here the server thread waits on the flash simulator instead.
+
+#define TEST_IMAGE_SIZE (256 * 1024)
+#define TEST_CHUNK_SIZE 1024
+#define TEST_STATUS_EVERY (8 * 1024)  // Upload bytes between status requests
+#define TEST_IDLE_POLLS 16
+#define TEST_MAX_POLLS (TEST_IMAGE_SIZE / TEST_STATUS_EVERY + TEST_IDLE_POLLS)
+#define TEST_MAX_PENDING 4  // Status streams open at once, below MAX_STREAMS
+#define TEST_REPLY_TIMEOUT_S 30
+#define TEST_WRITABLE_TIMEOUT K_SECONDS(2)  // As UPLOAD_WRITABLE_TIMEOUT
+
+#define HTTP_PORT 8080
+
+#define H2_FRAME_HDR_LEN 9
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_DEFAULT_WINDOW 65535
+
+static const char h2_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static uint8_t image[TEST_IMAGE_SIZE];
+static uint8_t frame_buf[CONFIG_HTTP_SERVER_CLIENT_BUFFER_SIZE + H2_FRAME_HDR_LEN];
+static int sock = -1;
+
+// Client side of the connection
+static uint32_t next_stream = 1;
+static int64_t conn_window;
+static int64_t upload_window;
+static int64_t initial_window = H2_DEFAULT_WINDOW;
+static uint32_t upload_stream;
+static bool upload_done;
+static int upload_status;
+
+struct status_poll {
+    uint32_t stream;
+    uint64_t sent;  // Cycle count when the request went out
+    uint32_t latency_us;
+    bool done;
+};
+
+static struct status_poll polls[TEST_MAX_POLLS];
+static size_t poll_count;
+static size_t polls_pending;
+
+// Stands in for MCUboot, which is not part of this build
+int boot_request_upgrade(int permanent)
+{
+    ARG_UNUSED(permanent);
+    
+    return 0;
+}
+
+// The application's upload handler without the multi-stream bookkeeping
+static int upload_handler(struct http_client_ctx *client, enum http_data_status status,
+                          const struct http_request_ctx *request_ctx,
+                          struct http_response_ctx *response_ctx, void *user_data)
+{
+    static bool started;
+    static uint32_t owner;
+    static int result;
+    
+    if (status == HTTP_SERVER_DATA_ABORTED) {
+        if (started && result == 0) {
+            ota_manager_abort_update(owner);
+        }
+        started = false;
+        return 0;
+    }
+    
+    if (!started) {
+        result = ota_manager_start_update(&owner);
+        started = true;
+    }
+    
+    if (result == 0 && request_ctx->data_len > 0) {
+        if (ota_manager_get_free_space() < request_ctx->data_len) {
+            result = ota_manager_wait_writable(request_ctx->data_len, TEST_WRITABLE_TIMEOUT);
+        }
+        if (result == 0) {
+            result = ota_manager_write_data(owner, request_ctx->data, request_ctx->data_len);
+        }
+        if (result) {
+            ota_manager_abort_update(owner);
+        }
+    }
+    
+    if (status == HTTP_SERVER_DATA_FINAL) {
+        if (result == 0) {
+            result = ota_manager_finish_update(owner);
+        }
+        
+        response_ctx->status = result ? 500 : 200;
+        response_ctx->final_chunk = true;
+        started = false;
+    }
+    
+    return 0;
+}
+
+static int status_handler(struct http_client_ctx *client, enum http_data_status status,
+                          const struct http_request_ctx *request_ctx,
+                          struct http_response_ctx *response_ctx, void *user_data)
+{
+    static char status_buf[1024];
+    
+    if (status == HTTP_SERVER_DATA_FINAL) {
+        ota_manager_get_status(status_buf, sizeof(status_buf));
+        response_ctx->status = 200;
+        response_ctx->body = status_buf;
+        response_ctx->body_len = strlen(status_buf);
+        response_ctx->final_chunk = true;
+    }
+    
+    return 0;
+}
+
+static struct http_resource_detail_dynamic upload_resource_detail = {
+    .common = {
+        .type = HTTP_RESOURCE_TYPE_DYNAMIC,
+        .bitmask_of_supported_http_methods = BIT(HTTP_POST),
+    },
+    .cb = upload_handler,
+    .user_data = NULL,
+};
+
+static struct http_resource_detail_dynamic status_resource_detail = {
+    .common = {
+        .type = HTTP_RESOURCE_TYPE_DYNAMIC,
+        .bitmask_of_supported_http_methods = BIT(HTTP_GET),
+    },
+    .cb = status_handler,
+    .user_data = NULL,
+};
+
+static uint16_t http_service_port = HTTP_PORT;
+HTTP_SERVICE_DEFINE(h2c_service, "127.0.0.1", &http_service_port, 1, 1, NULL);
+HTTP_RESOURCE_DEFINE(upload_resource, h2c_service, "/upload", &upload_resource_detail);
+HTTP_RESOURCE_DEFINE(status_resource, h2c_service, "/status", &status_resource_detail);
+
+static void send_all(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    
+    while (len > 0) {
+        ssize_t sent = zsock_send(sock, p, len, 0);
+        
+        zassert_true(sent > 0, "Send failed: %d", errno);
+        p += sent;
+        len -= sent;
+    }
+}
+
+static void recv_all(void *buf, size_t len)
+{
+    uint8_t *p = buf;
+    
+    while (len > 0) {
+        ssize_t received = zsock_recv(sock, p, len, 0);
+        
+        zassert_true(received > 0, "Connection closed or timed out: %d", errno);
+        p += received;
+        len -= received;
+    }
+}
+
+static void send_frame(uint8_t type, uint8_t flags, uint32_t stream,
+                       const void *payload, size_t len)
+{
+    uint8_t hdr[H2_FRAME_HDR_LEN];
+    
+    sys_put_be24(len, hdr);
+    hdr[3] = type;
+    hdr[4] = flags;
+    sys_put_be32(stream, hdr + 5);
+    
+    send_all(hdr, sizeof(hdr));
+    if (len > 0) {
+        send_all(payload, len);
+    }
+}
+
+static void send_window_update(uint32_t stream, uint32_t increment)
+{
+    uint8_t payload[4];
+    
+    sys_put_be32(increment, payload);
+    send_frame(H2_WINDOW_UPDATE, 0, stream, payload, sizeof(payload));
+}
+
+// Opens a stream with a request; returns its identifier
+static uint32_t send_request(const char *method, const char *path, bool end_stream)
+{
+    const char *fields[][2] = {
+        { ":method", method },
+        { ":scheme", "http" },
+        { ":path", path },
+        { ":authority", "127.0.0.1" },
+    };
+    static uint8_t block[128];
+    static struct http_hpack_header_buf header;
+    size_t len = 0;
+    
+    for (size_t i = 0; i < ARRAY_SIZE(fields); i++) {
+        header.name = fields[i][0];
+        header.name_len = strlen(fields[i][0]);
+        header.value = fields[i][1];
+        header.value_len = strlen(fields[i][1]);
+        
+        int ret = http_hpack_encode_header(block + len, sizeof(block) - len, &header);
+        
+        zassert_true(ret > 0, "HPACK encoding failed: %d", ret);
+        len += ret;
+    }
+    
+    uint32_t stream = next_stream;
+    
+    next_stream += 2;
+    send_frame(H2_HEADERS, H2_FLAG_END_HEADERS | (end_stream ? H2_FLAG_END_STREAM : 0),
+               stream, block, len);
+    
+    return stream;
+}
+
+static void send_status_request(void)
+{
+    zassert_true(poll_count < ARRAY_SIZE(polls));
+    
+    struct status_poll *poll = &polls[poll_count++];
+    
+    poll->sent = k_cycle_get_64();
+    poll->stream = send_request("GET", "/status", true);
+    poll->done = false;
+    polls_pending++;
+}
+
+static void stream_ended(uint32_t stream)
+{
+    if (stream == upload_stream) {
+        upload_done = true;
+        return;
+    }
+    
+    for (size_t i = 0; i < poll_count; i++) {
+        if (polls[i].stream == stream && !polls[i].done) {
+            // Measured to the end of the response body
+            polls[i].latency_us = (uint32_t)k_cyc_to_us_floor64(k_cycle_get_64() -
+                                                                polls[i].sent);
+            polls[i].done = true;
+            polls_pending--;
+            return;
+        }
+    }
+}
+
+static void on_headers(uint32_t stream, const uint8_t *block, size_t len)
+{
+    static struct http_hpack_header_buf header;
+    
+    // The server sends :status first
+    int ret = http_hpack_decode_header(block, len, &header);
+    
+    zassert_true(ret > 0, "HPACK decoding failed: %d", ret);
+    zassert_true(header.name_len == strlen(":status") &&
+                 memcmp(header.name, ":status", header.name_len) == 0);
+    
+    char code[4] = {0};
+    
+    memcpy(code, header.value, MIN(header.value_len, sizeof(code) - 1));
+    
+    if (stream == upload_stream) {
+        upload_status = atoi(code);
+    } else {
+        zassert_equal(atoi(code), 200, "Status request failed: %s", code);
+    }
+}
+
+// Handles one frame from the server; with wait false, only if one is
+// already waiting. Returns whether a frame was handled.
+static bool pump(bool wait)
+{
+    struct zsock_pollfd fds = { .fd = sock, .events = ZSOCK_POLLIN };
+    
+    if (!wait && zsock_poll(&fds, 1, 0) <= 0) {
+        return false;
+    }
+    
+    recv_all(frame_buf, H2_FRAME_HDR_LEN);
+    
+    size_t len = sys_get_be24(frame_buf);
+    uint8_t type = frame_buf[3];
+    uint8_t flags = frame_buf[4];
+    uint32_t stream = sys_get_be32(frame_buf + 5) & 0x7fffffff;
+    uint8_t *payload = frame_buf + H2_FRAME_HDR_LEN;
+    
+    zassert_true(len <= sizeof(frame_buf) - H2_FRAME_HDR_LEN, "Frame of %zu bytes", len);
+    recv_all(payload, len);
+    
+    switch (type) {
+    case H2_SETTINGS:
+        if (flags & H2_FLAG_ACK) {
+            break;
+        }
+        
+        for (size_t off = 0; off + 6 <= len; off += 6) {
+            if (sys_get_be16(payload + off) == H2_SETTINGS_INITIAL_WINDOW_SIZE) {
+                int64_t window = sys_get_be32(payload + off + 2);
+                
+                upload_window += window - initial_window;
+                initial_window = window;
+            }
+        }
+        send_frame(H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+        break;
+    case H2_WINDOW_UPDATE:
+        if (stream == 0) {
+            conn_window += sys_get_be32(payload) & 0x7fffffff;
+        } else if (stream == upload_stream) {
+            upload_window += sys_get_be32(payload) & 0x7fffffff;
+        }
+        break;
+    case H2_HEADERS:
+        on_headers(stream, payload, len);
+        break;
+    case H2_DATA:
+        // Status bodies add up; keep the server's connection window open
+        if (len > 0) {
+            send_window_update(0, len);
+        }
+        break;
+    case H2_RST_STREAM:
+    case H2_GOAWAY:
+        zassert_unreachable("Server reset stream %u (frame type %u)", stream, type);
+        break;
+    default:
+        break;
+    }
+    
+    if ((type == H2_HEADERS || type == H2_DATA) && (flags & H2_FLAG_END_STREAM)) {
+        stream_ended(stream);
+    }
+    
+    return true;
+}
+
+static void report(const char *phase, size_t first, size_t last)
+{
+    uint32_t sum = 0;
+    uint32_t max = 0;
+    uint32_t n = last - first;
+    
+    for (size_t i = first; i < last; i++) {
+        zassert_true(polls[i].done);
+        sum += polls[i].latency_us;
+        max = MAX(max, polls[i].latency_us);
+    }
+    
+    TC_PRINT("%-7s status over h2c: n=%u avg=%u us max=%u us\n", phase, n,
+             n ? sum / n : 0, max);
+}
+
+static void h2c_connect(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(HTTP_PORT),
+    };
+    struct timeval timeout = {
+        .tv_sec = TEST_REPLY_TIMEOUT_S,
+    };
+    
+    sock = zsock_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    zassert_true(sock >= 0);
+    zsock_inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    zassert_ok(zsock_setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)));
+    zassert_ok(zsock_connect(sock, (struct sockaddr *)&addr, sizeof(addr)));
+    
+    // Prior knowledge: no HTTP/1.1 upgrade, straight to the preface
+    send_all(h2_preface, strlen(h2_preface));
+    send_frame(H2_SETTINGS, 0, 0, NULL, 0);
+    
+    conn_window = H2_DEFAULT_WINDOW;
+}
+
+ZTEST(ota_h2c, test_status_latency)
+{
+    static char status[1024];
+    
+    h2c_connect();
+    
+    // Idle: one request at a time, nothing else on the connection
+    for (int i = 0; i < TEST_IDLE_POLLS; i++) {
+        send_status_request();
+        while (polls_pending > 0) {
+            pump(true);
+        }
+    }
+    
+    size_t idle_end = poll_count;
+    int64_t start = k_uptime_get();
+    
+    // Upload: the image as DATA frames on one stream, with a status request
+    // on a new stream every TEST_STATUS_EVERY bytes
+    upload_window = initial_window;
+    upload_stream = send_request("POST", "/upload", false);
+    
+    for (size_t off = 0; off < TEST_IMAGE_SIZE; off += TEST_CHUNK_SIZE) {
+        size_t len = MIN(TEST_CHUNK_SIZE, TEST_IMAGE_SIZE - off);
+        bool last = off + len == TEST_IMAGE_SIZE;
+        
+        while (conn_window < (int64_t)len || upload_window < (int64_t)len) {
+            pump(true);
+        }
+        
+        send_frame(H2_DATA, last ? H2_FLAG_END_STREAM : 0, upload_stream, &image[off], len);
+        conn_window -= len;
+        upload_window -= len;
+        
+        if (off % TEST_STATUS_EVERY == 0 && polls_pending < TEST_MAX_PENDING) {
+            send_status_request();
+        }
+        
+        while (pump(false)) {
+        }
+    }
+    
+    // finish_update includes the readback, so the upload answers last
+    while (!upload_done || polls_pending > 0) {
+        pump(true);
+    }
+    
+    zassert_equal(upload_status, 200, "Upload failed: %d", upload_status);
+    TC_PRINT("upload  %u bytes in %lld ms\n", TEST_IMAGE_SIZE, k_uptime_get() - start);
+    
+    report("idle", 0, idle_end);
+    report("upload", idle_end, poll_count);
+    
+    ota_manager_get_status(status, sizeof(status));
+    TC_PRINT("%s\n", status);
+    
+    zsock_close(sock);
+}
+
+static void *ota_h2c_setup(void)
+{
+    for (size_t i = 0; i < sizeof(image); i++) {
+        image[i] = (uint8_t)(i * 31 + (i >> 8));
+    }
+    
+    zassert_ok(ota_manager_init());
+    zassert_ok(http_server_start());
+    
+    return NULL;
+}
+
+ZTEST_SUITE(ota_h2c, NULL, ota_h2c_setup, NULL, NULL, NULL);
@@ -0,0 +1,38 @@
+function loadSystemInfo() {
+    fetch('/api/system/info')
+        .then(response => response.json())
+        .then(data => {
+            document.getElementById('system-info').innerHTML =
+                'Version: ' + data.version + '<br>' +
+                'Free Memory: ' + data.free_memory + ' bytes<br>' +
+                'Uptime: ' + data.uptime + ' seconds';
+        });
+}
+
+function loadWifiStatus() {
+    fetch('/api/wifi/status')
+        .then(response => response.json())
+        .then(data => {
+            document.getElementById('wifi-status').textContent = 'Status: ' + data.status;
+        });
+}
+
+function rebootDevice() {
+    if (confirm('Reboot?')) {
+        fetch('/api/system/reboot', { method: 'POST' });
+    }
+}
+
+document.getElementById('wifi-form').addEventListener('submit', event => {
+    event.preventDefault();
+    fetch('/api/wifi/connect', {
+        method: 'POST',
+        body: JSON.stringify({
+            ssid: document.getElementById('ssid').value,
+            password: document.getElementById('password').value
+        })
+    }).then(loadWifiStatus);
+});
+
+loadSystemInfo();
+loadWifiStatus();